@@ -39,6 +39,12 @@ typedef unsigned short Index16;
 
 #define GRANDPA_EXCEPTION
 
+//sse2 kernels for sampling, blending and skinning (x86 only)
+#define GRANDPA_SIMD
+
+//also build avx2 kernels, picked at runtime if cpu supports (needs vs2012 or later)
+//#define GRANDPA_AVX2
+
 #if defined(GRANDPA_EXCEPTION)
 #else
 	#if defined (_MSC_VER)
@@ -29,6 +29,7 @@
 #include "IMaterial.h"
 #include "IProperty.h"
 #include "ISpline.h"
+#include "ITaskScheduler.h"
 
 class PerfManager;
 
@@ -37,7 +38,8 @@ namespace grp
 
 GRANDPA_API bool initialize(ILogger* logger = NULL, IFileLoader* fileLoader = NULL,
 							 IAllocator* allocator = NULL, IResourceManager* resourceManager = NULL,
-							 AnimationSampleType sampleType = SAMPLE_LINEAR);
+							 AnimationSampleType sampleType = SAMPLE_LINEAR,
+							 bool compressAnimation = false);
 GRANDPA_API void destroy();
 
 GRANDPA_API IResource* grabResource(const Char* url, ResourceType type, void* param0 = NULL, void* param1 = NULL);
@@ -66,6 +68,24 @@ GRANDPA_API void destroySpline(ISpline<T>* spline);
 
 GRANDPA_API void setProfiler(PerfManager* perfManager);
 
+//share sampled poses of linear/step animations among models playing the same clip,
+//sample time is rounded to 1/subframes of a frame. 0 disables (default).
+//poses not used lately are released to keep about maxPoses.
+//models may be updated on several threads only if library is built with _GRP_WIN32_THREAD_SAFE
+GRANDPA_API void enablePoseCache(unsigned int subframes, size_t maxPoses = 1024);
+//release poses not used since last call, optional, keeps the cache smaller than maxPoses
+GRANDPA_API void flushPoseCache();
+GRANDPA_API void getPoseCacheCounters(unsigned long& hitCount, unsigned long& missCount, bool reset = false);
+
+//skeletons with at least parallelBoneCount bones to evaluate split their hierarchy update into
+//independent subtrees run by scheduler. NULL scheduler (default) keeps all updates serial
+GRANDPA_API void setTaskScheduler(ITaskScheduler* scheduler, size_t parallelBoneCount = 512);
+
+//bake a coarse box track when an animation is first played on a skeleton, needed by
+//IModel::predictBoundingBox. baking samples the whole clip, disabled by default.
+//only animations built afterwards are affected
+GRANDPA_API void enableBoundingTracks(bool enable);
+
 }
 
 #endif
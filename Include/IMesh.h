@@ -18,6 +18,14 @@ const unsigned long COLOR		= 0x00002000L;
 const unsigned long BLENDINDICES= 0x00004000L;
 const unsigned long BLENDWEIGHT	= 0X00008000L;
 
+//encodings of skinned vertices, see ISkin::setOutputFormat()
+const unsigned long POSITION_HALF	= 0x00010000L;	//4 half floats, w is 1
+const unsigned long POSITION_UNORM16= 0x00020000L;	//4 unsigned shorts in ISkin::getPositionRange(), w is 1
+const unsigned long NORMAL_OCT		= 0x00040000L;	//2 shorts octahedral, tangent and binormal too
+const unsigned long TANGENT_QUAT	= 0x00080000L;	//4 shorts quaternion of tangent frame in place of normal,
+													//negative w for mirrored binormal, no tangent data
+const unsigned long VERTEX_ENCODING	= 0x000f0000L;
+
 class IMeshBuffer;
 class ISkin;
 class IVertexStream;
@@ -73,6 +73,11 @@ public:
 
 	virtual void enableSkeletonLod(bool enable) = 0;
 	virtual bool isSkeletonLodEnabled() const = 0;
+
+	//pose is evaluated once every interval updates and held in between, 1 means every update
+	//animation time, events and sync groups still advance every update
+	virtual void setUpdateInterval(unsigned int interval) = 0;
+	virtual unsigned int getUpdateInterval() const = 0;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -88,6 +93,11 @@ public:
 	virtual void unsetFixedBoundingBox() = 0;
 	virtual const AaBox& getBoundingBox() const = 0;
 
+	//coarse box from baked animation tracks at current animation times, without update,
+	//so invisible models can be culled before updating them. same space as getBoundingBox(),
+	//false if no playing animation can predict it, see enableBoundingTracks
+	virtual bool predictBoundingBox(AaBox& box) const = 0;
+
 	virtual ISkeleton* getSkeleton() = 0;
 
 	virtual void setGlobalSkinning(bool enable) = 0;
@@ -48,6 +48,15 @@ public:
 	virtual void onPostIk(ISkeleton* skeleton) {}
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+enum IkSolverType
+{
+	IK_SOLVER_AUTO = 0,		//two bone for chains of 2, fabrik for longer ones
+	IK_SOLVER_CCD,			//iterative, works on any list of bones
+	IK_SOLVER_TWO_BONE,		//analytic, bones must be parent and grandparent of source
+	IK_SOLVER_FABRIK		//bones must be consecutive ancestors of source, nearest first
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class IIkSolver
 {
@@ -104,12 +113,19 @@ public:
 									const IkBoneData* data,
 									size_t boneCount,
 									float threshold,
-									bool keepSourceRotation = true) = 0;
+									bool keepSourceRotation = true,
+									IkSolverType type = IK_SOLVER_AUTO) = 0;
 
 	virtual void setCallback(ISkeletonCallback* callback) = 0;
 
 	virtual void removeCallback() = 0;
 
+	//whether bone's absolute transform was recomputed or set since last update began,
+	//skinning and attachments of unchanged bones can be skipped
+	virtual bool isBoneChanged(size_t id) const = 0;
+
+	virtual size_t getChangedBoneCount() const = 0;
+
 protected:
 	virtual ~ISkeleton(){}
 };
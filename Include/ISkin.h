@@ -29,11 +29,37 @@ public:
 
 	virtual size_t getSkinVertexCount() const = 0;
 
+	//MAX_VERTEX_INFLUENCE influences of the vertex, valid until next call.
+	//weights are quantized to 16 bits for skins of at most 256 bones
 	virtual const VertexInfluence* getVertexInfluences(size_t vertexIndex) const = 0;
 
 	virtual void setGpuSkinning(bool enable) = 0;
 	virtual bool isGpuSkinning() const = 0;
 
+	//cpu skinning writes straight into buffer (a locked vertex buffer for example) and the
+	//internal one is released. format must hold the dynamic stream's format, layout of a vertex
+	//follows getDataOffset() of format and other channels are left alone. buffer must stay
+	//valid until update is done, set it again for every frame if it moves.
+	//every vertex is written on next update unless preserved promises buffer still holds what
+	//was last skinned into it (not a discarded lock), then unchanged vertices are skipped.
+	//NULL goes back to internal buffer, fails if gpu skinning
+	virtual bool setOutputBuffer(void* buffer, size_t stride, unsigned long format, bool preserved = false) = 0;
+	virtual bool hasOutputBuffer() const = 0;
+
+	//cpu skinning packs vertices of internal buffer with encodings (POSITION_HALF, NORMAL_OCT,
+	//TANGENT_QUAT... of IMesh.h), reported by getFormat() of dynamic stream. 0 is plain floats.
+	//caller's buffer takes encodings from format of setOutputBuffer() instead. fails if gpu skinning
+	virtual bool setOutputFormat(unsigned long encoding) = 0;
+	virtual unsigned long getOutputFormat() const = 0;
+
+	//POSITION_UNORM16 decodes as offset + stored * scale, both follow the pose so they
+	//change with getSkinGeneration()
+	virtual void getPositionRange(Vector3& offset, Vector3& scale) const = 0;
+
+	//changes whenever skinned vertices are rewritten, or bone matrices change if gpu skinning.
+	//same value as last frame means nothing to upload
+	virtual unsigned long getSkinGeneration() const = 0;
+
 	virtual void setUserData(void* data) = 0;
 	virtual void* getUserData() const = 0;
 
@@ -0,0 +1,31 @@
+#ifndef __GRP_I_TASK_SCHEDULER_H__
+#define __GRP_I_TASK_SCHEDULER_H__
+
+namespace grp
+{
+
+class ITask
+{
+public:
+	//called once for every index, possibly from several threads at the same time
+	virtual void execute(size_t index) = 0;
+
+protected:
+	virtual ~ITask(){}
+};
+
+class ITaskScheduler
+{
+public:
+	virtual ~ITaskScheduler(){}
+
+	//threads that can run tasks, including the calling one
+	virtual size_t getWorkerCount() const = 0;
+
+	//run task->execute(i) for i in [0, count), return when all of them have finished
+	virtual void run(ITask* task, size_t count) = 0;
+};
+
+}
+
+#endif
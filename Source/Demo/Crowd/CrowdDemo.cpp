@@ -333,9 +333,14 @@ void updateCharacters(double time, float elapsedTime)
 	{
 		if (g_characters[i] != NULL)
 		{
+			//distant characters evaluate their pose less often
+			grp::IModel* model = g_characters[i]->getModel();
+			float distance = (model->getTransform().getTranslation() - g_camera.getEyePos()).length();
+			model->setUpdateInterval(distance < FLOOR_SIZE ? 1 : (distance < FLOOR_SIZE * 2 ? 2 : 4));
 			g_characters[i]->update(time, elapsedTime, grp::UPDATE_NO_BOUNDING_BOX);
 		}
 	}
+	grp::flushPoseCache();
 }
 
 void renderCharacters(ID3DXEffect* effect, const D3DXMATRIXA16& mView, const D3DXMATRIXA16& mProj)
@@ -459,7 +464,8 @@ HRESULT CALLBACK OnCreateDevice(IDirect3DDevice9* pd3dDevice, const D3DSURFACE_D
 	g_fileLoader->enableMultithread(false);
 	g_resourceManager = new MultithreadResManager(g_fileLoader);
 
-	grp::initialize(NULL, g_fileLoader, NULL, g_resourceManager, grp::SAMPLE_LINEAR);
+	grp::initialize(NULL, g_fileLoader, NULL, g_resourceManager, grp::SAMPLE_LINEAR, true);
+	grp::enablePoseCache(4);
 
 	g_device = pd3dDevice;
 
@@ -769,6 +775,10 @@ void RenderText(double fTime)
 	txtHelper.SetInsertionPos(2, 0);
 	txtHelper.SetForegroundColor(D3DXCOLOR(1.0f, 1.0f, 0.0f, 1.0f));
 	txtHelper.DrawTextLine(DXUTGetFrameStats(DXUTIsVsyncEnabled()));
+
+	unsigned long hitCount, missCount;
+	grp::getPoseCacheCounters(hitCount, missCount, true);
+	txtHelper.DrawFormattedTextLine(L"Pose cache: %lu hits, %lu misses", hitCount, missCount);
 	txtHelper.End();
 }
 
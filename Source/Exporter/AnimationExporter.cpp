@@ -3,17 +3,21 @@
 #include "ChunkFileIo.h"
 #include "Spline.h"
 #include "SplineSampler.h"
+#include "SkeletonExporter.h"
 
 namespace grp
 {
 
-static const int CURRENT_VERSION = 0x0100;
+//0x0101: empty position/rotation channel means bind pose
+static const int CURRENT_VERSION = 0x0101;
+static const int BAKE_VERSION = 0x0100;
 
 extern unsigned long compressQuaternion(const Quaternion& q);
 
 ///////////////////////////////////////////////////////////////////////////////
 AnimationExporter::AnimationExporter()
 	: m_duration(0.0f)
+	, m_keysReduced(false)
 {
 }
 
@@ -28,6 +32,14 @@ bool AnimationExporter::exportTo(std::ostream& output, float fps, bool compressQ
 	//			TRAN
 	//			ROTA
 	//			SCAL
+	//	BAKE
+	//		BTRK
+	//			PKNT		spline only
+	//			RKNT
+	//			SKNT
+	//			PFRM		linear and step only
+	//			RFRM/CRFM
+	//			SFRM
 	if (!createChunk(output, 'ANIM', sizeof(CURRENT_VERSION), (const char*)&CURRENT_VERSION))
 	{
 		return false;
@@ -126,6 +138,13 @@ bool AnimationExporter::exportTo(std::ostream& output, float fps, bool compressQ
 		return false;
 	}
 	fileChunkSize += (allTrackChunkSize + CHUNK_HEADER_SIZE);
+
+	size_t bakeChunkSize;
+	if (!exportBakedTracks(output, fps, compressQuat, bakeChunkSize))
+	{
+		return false;
+	}
+	fileChunkSize += (bakeChunkSize + CHUNK_HEADER_SIZE);
 	if (!updateChunkSize(output, fileChunkSize))
 	{
 		return false;
@@ -133,6 +152,131 @@ bool AnimationExporter::exportTo(std::ostream& output, float fps, bool compressQ
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//same as what runtime does to linear and step animations at load time
+template<typename KeyType, typename TransformType>
+void AnimationExporter::resampleKeys(const VECTOR(KeyType)& keys, const VECTOR(TransformType)& knots,
+									 size_t frameCount, float fps, VECTOR(TransformType)& frames) const
+{
+	if (keys.size() < 2)
+	{
+		frames.resize(keys.size());
+		if (!keys.empty())
+		{
+			frames[0] = keys[0].transform;
+		}
+		return;
+	}
+	frames.resize(frameCount);
+	for (size_t i = 0; i < frameCount; ++i)
+	{
+		float time = i / fps;
+		if (time > keys.back().time)
+		{
+			time = keys.back().time;
+		}
+		SplineSampler::sample(keys, knots, time, frames[i]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+bool AnimationExporter::exportBakedKeys(std::ostream& output, int chunkName, const VECTOR(T)& keys,
+										size_t& trackChunkSize) const
+{
+	if (keys.empty())
+	{
+		return true;
+	}
+	size_t keySize = keys.size() * sizeof(T);
+	if (!createChunk(output, chunkName, keySize, (const char*)&keys[0]))
+	{
+		return false;
+	}
+	trackChunkSize += (keySize + CHUNK_HEADER_SIZE);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//knots of spline clips or resampled frames of others, so that runtime needn't compute them when
+//loading. runtime playing a spline clip as linear resamples it itself
+bool AnimationExporter::exportBakedTracks(std::ostream& output, float fps, bool compressQuat, size_t& outputSize) const
+{
+	if (!createChunk(output, 'BAKE'))
+	{
+		return false;
+	}
+	size_t frameCount = static_cast<size_t>(m_duration * fps) + 1;
+	output.write((const char*)&BAKE_VERSION, sizeof(BAKE_VERSION));
+	output.write((const char*)&frameCount, sizeof(frameCount));
+	outputSize = sizeof(BAKE_VERSION) + sizeof(frameCount);
+
+	bool bakeKnots = (m_sampleType == SAMPLE_SPLINE);
+	for (size_t i = 0; i < m_boneTracks.size(); ++i)
+	{
+		if (!createChunk(output, 'BTRK'))
+		{
+			return false;
+		}
+		const BoneTrack& boneTrack = m_boneTracks[i];
+		BoneTrack bakedTrack;
+		getSplineKnotsForKeys(boneTrack.positionKeys, bakedTrack.positionKnots, true);
+		getSplineKnotsForKeys(boneTrack.rotationKeys, bakedTrack.rotationKnots, true);
+		getSplineKnotsForKeys(boneTrack.scaleKeys, bakedTrack.scaleKnots, true);
+
+		size_t trackChunkSize = 0;
+		if (bakeKnots)
+		{
+			if (!exportBakedKeys(output, 'PKNT', bakedTrack.positionKnots, trackChunkSize)
+				|| !exportBakedKeys(output, 'RKNT', bakedTrack.rotationKnots, trackChunkSize)
+				|| !exportBakedKeys(output, 'SKNT', bakedTrack.scaleKnots, trackChunkSize))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			VECTOR(Vector3) positions;
+			VECTOR(Quaternion) rotations;
+			VECTOR(Vector3) scales;
+			resampleKeys(boneTrack.positionKeys, bakedTrack.positionKnots, frameCount, fps, positions);
+			resampleKeys(boneTrack.rotationKeys, bakedTrack.rotationKnots, frameCount, fps, rotations);
+			resampleKeys(boneTrack.scaleKeys, bakedTrack.scaleKnots, frameCount, fps, scales);
+			//runtime reads them in this order
+			if (!exportBakedKeys(output, 'PFRM', positions, trackChunkSize))
+			{
+				return false;
+			}
+			if (compressQuat)
+			{
+				VECTOR(unsigned long) compressed(rotations.size());
+				for (size_t j = 0; j < rotations.size(); ++j)
+				{
+					compressed[j] = compressQuaternion(rotations[j]);
+				}
+				if (!exportBakedKeys(output, 'CRFM', compressed, trackChunkSize))
+				{
+					return false;
+				}
+			}
+			else if (!exportBakedKeys(output, 'RFRM', rotations, trackChunkSize))
+			{
+				return false;
+			}
+			if (!exportBakedKeys(output, 'SFRM', scales, trackChunkSize))
+			{
+				return false;
+			}
+		}
+		if (!updateChunkSize(output, trackChunkSize))
+		{
+			return false;
+		}
+		outputSize += (trackChunkSize + CHUNK_HEADER_SIZE);
+	}
+	return updateChunkSize(output, outputSize);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void AnimationExporter::splineFitTracks(float positionThreshold, float rotationThreshold, float scaleThreshold)
 {
@@ -154,6 +298,224 @@ void AnimationExporter::splineFitTracks(float positionThreshold, float rotationT
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AnimationExporter::reduceKeys(const SkeletonExporter& skeleton, float maxError)
+{
+	KeyReductionReport& report = m_keyReductionReport;
+
+	const VECTOR(CoreBone)& bones = skeleton.getCoreBones();
+	size_t boneCount = bones.size();
+
+	//bind pose in model space, parent is always exported before children
+	VECTOR(Matrix) bindTransforms(boneCount);
+	VECTOR(int) depths(boneCount, 0);
+	int maxDepth = 0;
+	for (size_t i = 0; i < boneCount; ++i)
+	{
+		const CoreBone& bone = bones[i];
+		Matrix local;
+		local.setTransform(bone.position, bone.rotation, bone.scale);
+		if (bone.parentId < 0)
+		{
+			bindTransforms[i] = local;
+		}
+		else
+		{
+			assert(bone.parentId < static_cast<int>(i));
+			local.multiply_optimized(bindTransforms[bone.parentId], bindTransforms[i]);
+			depths[i] = depths[bone.parentId] + 1;
+		}
+		maxDepth = std::max(maxDepth, depths[i]);
+	}
+	//reach of a bone: max distance to its descendants, at least its own length
+	VECTOR(float) reaches(boneCount, 0.0f);
+	for (size_t i = 0; i < boneCount; ++i)
+	{
+		const Vector3& position = bindTransforms[i].getTranslation();
+		int parentId = bones[i].parentId;
+		if (parentId >= 0)
+		{
+			reaches[i] = std::max(reaches[i], position.distance(bindTransforms[parentId].getTranslation()));
+		}
+		for (; parentId >= 0; parentId = bones[parentId].parentId)
+		{
+			float distance = position.distance(bindTransforms[parentId].getTranslation());
+			reaches[parentId] = std::max(reaches[parentId], distance);
+		}
+	}
+	//errors along a bone chain add up, split budget evenly to every level
+	float boneError = maxError / (maxDepth + 1);
+
+	VECTOR(BoneTrack) sourceTracks(m_boneTracks);
+	VECTOR(int) trackBoneIds(m_boneTracks.size());
+
+	report.sourceKeyCount = 0;
+	report.keyCount = 0;
+	report.sourceSize = 0;
+	report.size = 0;
+	report.strippedChannelCount = 0;
+	for (size_t i = 0; i < m_boneTracks.size(); ++i)
+	{
+		BoneTrack& boneTrack = m_boneTracks[i];
+		report.sourceKeyCount += (boneTrack.positionKeys.size() + boneTrack.rotationKeys.size() + boneTrack.scaleKeys.size());
+		report.sourceSize += (boneTrack.positionKeys.size() * sizeof(Vector3Key)
+							+ boneTrack.rotationKeys.size() * sizeof(QuaternionKey)
+							+ boneTrack.scaleKeys.size() * sizeof(Vector3Key));
+
+		int boneId = skeleton.getBoneId(boneTrack.boneName);
+		trackBoneIds[i] = boneId;
+		if (boneId < 0)
+		{
+			//no hierarchy info, can't tell how error spreads
+			if (boneTrack.positionKeys.size() > 1)
+			{
+				splineFitKeys(boneTrack.positionKeys, boneTrack.positionKnots, boneError);
+			}
+			if (boneTrack.rotationKeys.size() > 1)
+			{
+				splineFitKeys(boneTrack.rotationKeys, boneTrack.rotationKnots, boneError);
+			}
+			if (boneTrack.scaleKeys.size() > 1)
+			{
+				splineFitKeys(boneTrack.scaleKeys, boneTrack.scaleKnots, boneError);
+			}
+		}
+		else
+		{
+			const CoreBone& bone = bones[boneId];
+			float reach = std::max(reaches[boneId], boneError);
+			//rotating angle a moves points at distance d by about a * d, and a is about 2 * quaternion distance
+			if (reduceChannel(boneTrack.positionKeys, boneTrack.positionKnots, bone.position, boneError))
+			{
+				++report.strippedChannelCount;
+			}
+			if (reduceChannel(boneTrack.rotationKeys, boneTrack.rotationKnots, bone.rotation, boneError / reach * 0.5f))
+			{
+				++report.strippedChannelCount;
+			}
+			if (reduceChannel(boneTrack.scaleKeys, boneTrack.scaleKnots, bone.scale, boneError / reach))
+			{
+				++report.strippedChannelCount;
+			}
+		}
+		report.keyCount += (boneTrack.positionKeys.size() + boneTrack.rotationKeys.size() + boneTrack.scaleKeys.size());
+		report.size += (boneTrack.positionKeys.size() * sizeof(Vector3Key)
+						+ boneTrack.rotationKeys.size() * sizeof(QuaternionKey)
+						+ boneTrack.scaleKeys.size() * sizeof(Vector3Key));
+	}
+	report.maxError = measureError(skeleton, sourceTracks, trackBoneIds, report.maxErrorBone);
+	m_keysReduced = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//key of source frame, the last one if channel is shorter. time is taken from the channel
+//holding the frame, so a constant channel doesn't move it
+template<typename T>
+static void getSourceFrame(const VECTOR(TransformKey<T>)& keys, size_t frame, T& out, float& time)
+{
+	if (keys.empty())
+	{
+		return;
+	}
+	const TransformKey<T>& key = keys[std::min(frame, keys.size() - 1)];
+	out = key.transform;
+	if (frame < keys.size())
+	{
+		time = key.time;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//play reduced tracks the way runtime does and compare to source frames
+float AnimationExporter::measureError(const SkeletonExporter& skeleton, const VECTOR(BoneTrack)& sourceTracks,
+									  const VECTOR(int)& trackBoneIds, STRING& maxErrorBone)
+{
+	const VECTOR(CoreBone)& bones = skeleton.getCoreBones();
+	size_t boneCount = bones.size();
+
+	VECTOR(BoneTrack) runtimeTracks(m_boneTracks);
+	VECTOR(int) boneTrackIds(boneCount, -1);
+	size_t frameCount = 0;
+	for (size_t i = 0; i < runtimeTracks.size(); ++i)
+	{
+		BoneTrack& boneTrack = runtimeTracks[i];
+		getSplineKnotsForKeys(boneTrack.positionKeys, boneTrack.positionKnots, true);
+		getSplineKnotsForKeys(boneTrack.rotationKeys, boneTrack.rotationKnots, true);
+		getSplineKnotsForKeys(boneTrack.scaleKeys, boneTrack.scaleKnots, true);
+		if (trackBoneIds[i] >= 0)
+		{
+			boneTrackIds[trackBoneIds[i]] = static_cast<int>(i);
+		}
+		const BoneTrack& source = sourceTracks[i];
+		frameCount = std::max(frameCount, source.positionKeys.size());
+		frameCount = std::max(frameCount, source.rotationKeys.size());
+		frameCount = std::max(frameCount, source.scaleKeys.size());
+	}
+
+	float maxError = 0.0f;
+	maxErrorBone.clear();
+	VECTOR(Matrix) sourceTransforms(boneCount);
+	VECTOR(Matrix) runtimeTransforms(boneCount);
+	for (size_t frame = 0; frame < frameCount; ++frame)
+	{
+		for (size_t i = 0; i < boneCount; ++i)
+		{
+			const CoreBone& bone = bones[i];
+			Vector3 sourcePosition = bone.position;
+			Quaternion sourceRotation = bone.rotation;
+			Vector3 sourceScale = bone.scale;
+			Vector3 runtimePosition = bone.position;
+			Quaternion runtimeRotation = bone.rotation;
+			Vector3 runtimeScale = bone.scale;
+			int trackId = boneTrackIds[i];
+			if (trackId >= 0)
+			{
+				//missing channels are bind pose, on both sides
+				const BoneTrack& source = sourceTracks[trackId];
+				const BoneTrack& runtime = runtimeTracks[trackId];
+				float time = 0.0f;
+				getSourceFrame(source.scaleKeys, frame, sourceScale, time);
+				getSourceFrame(source.rotationKeys, frame, sourceRotation, time);
+				getSourceFrame(source.positionKeys, frame, sourcePosition, time);
+				if (!runtime.positionKeys.empty())
+				{
+					SplineSampler::sample(runtime.positionKeys, runtime.positionKnots, time, runtimePosition);
+				}
+				if (!runtime.rotationKeys.empty())
+				{
+					SplineSampler::sample(runtime.rotationKeys, runtime.rotationKnots, time, runtimeRotation);
+					runtimeRotation.normalize();
+				}
+				if (!runtime.scaleKeys.empty())
+				{
+					SplineSampler::sample(runtime.scaleKeys, runtime.scaleKnots, time, runtimeScale);
+				}
+			}
+			Matrix sourceLocal;
+			sourceLocal.setTransform(sourcePosition, sourceRotation, sourceScale);
+			Matrix runtimeLocal;
+			runtimeLocal.setTransform(runtimePosition, runtimeRotation, runtimeScale);
+			if (bone.parentId < 0)
+			{
+				sourceTransforms[i] = sourceLocal;
+				runtimeTransforms[i] = runtimeLocal;
+			}
+			else
+			{
+				sourceLocal.multiply_optimized(sourceTransforms[bone.parentId], sourceTransforms[i]);
+				runtimeLocal.multiply_optimized(runtimeTransforms[bone.parentId], runtimeTransforms[i]);
+			}
+			float error = sourceTransforms[i].getTranslation().distance(runtimeTransforms[i].getTranslation());
+			if (error > maxError)
+			{
+				maxError = error;
+				maxErrorBone = bone.name;
+			}
+		}
+	}
+	return maxError;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void AnimationExporter::clear()
 {
@@ -8,6 +8,33 @@
 namespace grp
 {
 
+class SkeletonExporter;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline float getKeyDistance(const Vector3& v1, const Vector3& v2)
+{
+	return v1.distance(v2);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline float getKeyDistance(const Quaternion& q1, const Quaternion& q2)
+{
+	//q and -q are the same rotation
+	return std::min(q1.distance(q2), q1.distance(q2 * -1.0f));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct KeyReductionReport
+{
+	float	maxError;			//max model space bone position error of all frames
+	STRING	maxErrorBone;
+	size_t	sourceKeyCount;
+	size_t	keyCount;
+	size_t	sourceSize;			//key data in bytes
+	size_t	size;
+	size_t	strippedChannelCount;	//constant channels identical to bind pose
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class AnimationExporter
 {
@@ -25,6 +52,9 @@ public:
 
 	AnimationSampleType getSampleType() const;
 
+	//NULL if keys are not reduced
+	const KeyReductionReport* getKeyReductionReport() const;
+
 private:
 	void clear();
 
@@ -32,10 +62,29 @@ private:
 	void splineFitKeys(VECTOR(KeyType)& keys, VECTOR(TransformType)& knots, float threshold);
 
 	template<typename KeyType, typename TransformType>
-	void getSplineKnotsForKeys(VECTOR(KeyType)& keys, VECTOR(TransformType)& knots);
+	void getSplineKnotsForKeys(const VECTOR(KeyType)& keys, VECTOR(TransformType)& knots, bool cycle = false) const;
+
+	template<typename KeyType, typename TransformType>
+	void resampleKeys(const VECTOR(KeyType)& keys, const VECTOR(TransformType)& knots,
+						size_t frameCount, float fps, VECTOR(TransformType)& frames) const;
+
+	bool exportBakedTracks(std::ostream& output, float fps, bool compressQuat, size_t& outputSize) const;
+
+	template<typename T>
+	bool exportBakedKeys(std::ostream& output, int chunkName, const VECTOR(T)& keys, size_t& trackChunkSize) const;
 
 	void splineFitTracks(float positionThreshold, float rotationThreshold, float scaleThreshold);
 
+	//remove keys under a model space error budget, strip constant and bind pose channels
+	void reduceKeys(const SkeletonExporter& skeleton, float maxError);
+
+	template<typename KeyType, typename TransformType>
+	bool reduceChannel(VECTOR(KeyType)& keys, VECTOR(TransformType)& knots,
+						const TransformType& bindTransform, float threshold);
+
+	float measureError(const SkeletonExporter& skeleton, const VECTOR(BoneTrack)& sourceTracks,
+						const VECTOR(int)& trackBoneIds, STRING& maxErrorBone);
+
 	bool exportCompressedRotationsKeys(std::ostream& output, const VECTOR(QuaternionKey)& keys,
 										size_t& outputSize) const;
 
@@ -43,6 +92,8 @@ private:
 	float				m_duration;
 	VECTOR(BoneTrack)	m_boneTracks;
 	AnimationSampleType	m_sampleType;
+	KeyReductionReport	m_keyReductionReport;
+	bool				m_keysReduced;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -86,7 +137,7 @@ void AnimationExporter::splineFitKeys(VECTOR(KeyType)& keys, VECTOR(TransformTyp
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename KeyType, typename TransformType>
-void AnimationExporter::getSplineKnotsForKeys(VECTOR(KeyType)& keys, VECTOR(TransformType)& knots)
+void AnimationExporter::getSplineKnotsForKeys(const VECTOR(KeyType)& keys, VECTOR(TransformType)& knots, bool cycle) const
 {
 	if (keys.size() < 2)
 	{
@@ -100,7 +151,41 @@ void AnimationExporter::getSplineKnotsForKeys(VECTOR(KeyType)& keys, VECTOR(Tran
 		positions[i] = keys[i].transform;
 		timeArray[i] = keys[i].time;
 	}
-	getSplineKnots(&positions[0], positions.size(), &(knots[0]), &timeArray[0]);
+	getSplineKnots(&positions[0], positions.size(), &(knots[0]), &timeArray[0], cycle);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//return true if channel is stripped
+template<typename KeyType, typename TransformType>
+bool AnimationExporter::reduceChannel(VECTOR(KeyType)& keys, VECTOR(TransformType)& knots,
+									  const TransformType& bindTransform, float threshold)
+{
+	if (keys.empty())
+	{
+		return false;
+	}
+	bool constant = true;
+	for (size_t i = 1; i < keys.size(); ++i)
+	{
+		if (getKeyDistance(keys[i].transform, keys[0].transform) > threshold)
+		{
+			constant = false;
+			break;
+		}
+	}
+	if (!constant)
+	{
+		splineFitKeys(keys, knots, threshold);
+		return false;
+	}
+	knots.clear();
+	if (getKeyDistance(keys[0].transform, bindTransform) <= threshold)
+	{
+		keys.clear();
+		return true;
+	}
+	keys.resize(1);
+	return false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -109,6 +194,12 @@ inline AnimationSampleType AnimationExporter::getSampleType() const
 	return m_sampleType;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline const KeyReductionReport* AnimationExporter::getKeyReductionReport() const
+{
+	return m_keysReduced ? &m_keyReductionReport : NULL;
+}
+
 }
 
 #endif
@@ -8,6 +8,7 @@ namespace grp
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 Animation::Animation()
 	: m_resource(NULL)
+	, m_boneBinding(NULL)
 	, m_time(0.0f)
 	, m_timeScale(1.0f)
 	, m_startTime(0.0f)
@@ -28,6 +29,7 @@ Animation::Animation()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 Animation::~Animation()
 {
+	dropBoneBinding();
 	SAFE_DROP(m_resource);
 }
 
@@ -80,7 +82,7 @@ bool Animation::update(float elapsedTime)
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
-void Animation::build(VECTOR(int)& boneIds)
+void Animation::build(const BoneBinding& binding)
 {
 	assert(m_resource != NULL);
 	assert(m_resource->getResourceState() == RES_STATE_COMPLETE);
@@ -92,10 +94,27 @@ void Animation::build(VECTOR(int)& boneIds)
 	{
 		m_endTime = m_resource->getDuration();
 	}
-	m_boneIds.swap(boneIds);
+	dropBoneBinding();
+	m_boneBinding = &binding;
+	if (m_resource->getSampleType() == SAMPLE_SPLINE)
+	{
+		TrackCursor cursor = { 0, 0, 0 };
+		m_trackCursors.assign(binding.tracks.size(), cursor);
+	}
 	setBuilt();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Animation::dropBoneBinding()
+{
+	if (m_boneBinding != NULL)
+	{
+		assert(m_resource != NULL);
+		m_resource->dropBoneBinding(*m_boneBinding);
+		m_boneBinding = NULL;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Animation::updateTime(float elapsedTime)
 {
@@ -4,11 +4,13 @@
 #include "IResource.h"
 #include "IAnimation.h"
 #include "ResourceInstance.h"
+#include "AnimationSampler.h"
 #include <vector>
 
 namespace grp
 {
 class AnimationFile;
+struct BoneBinding;
 template<class T, ResourceType resType> class ContentResource;
 typedef ContentResource<AnimationFile, RES_TYPE_ANIMATION> AnimationResource;
 
@@ -53,14 +55,18 @@ public:
 
 	bool update(float elapsedTime);
 
-	int getBoneId(unsigned long index) const;
+	const BoneBinding& getBoneBinding() const;
+
+	//index is position in bone binding
+	TrackCursor& getTrackCursor(unsigned long index);
 
 	bool isEnding() const;
 
 	void setAnimationResource(const AnimationResource* resource);
 	const AnimationResource* getAnimationResource() const;
 
-	void build(VECTOR(int)& boneIds);
+	//takes over one grab of binding from resource, dropped on rebuild or destruction
+	void build(const BoneBinding& binding);
 
 	float getSampleTime() const;
 
@@ -72,9 +78,13 @@ private:
 
 	bool updateWeight(float elapsedTime);
 
+	void dropBoneBinding();
+
 private:
 	const AnimationResource*	m_resource;
-	VECTOR(int)		m_boneIds;
+	const BoneBinding*			m_boneBinding;	//shared by resource, grabbed while built
+	//last sampled key of every bound track (spline only), time jumps (loop, setTime) fall back to binary search
+	VECTOR(TrackCursor)	m_trackCursors;
 
 	float	m_time;
 	float	m_timeScale;
@@ -101,6 +111,7 @@ private:
 //////////////////////////////////////////////////////////////////////////////////////////////////
 inline void Animation::setAnimationResource(const AnimationResource* resource)
 {
+	dropBoneBinding();
 	SAFE_DROP(m_resource);
 	resource->grab();
 	m_resource = resource;
@@ -128,10 +139,17 @@ inline void Animation::setClip(float startTime, float endTime)
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
-inline int Animation::getBoneId(unsigned long index) const
+inline const BoneBinding& Animation::getBoneBinding() const
+{
+	assert(m_boneBinding != NULL);
+	return *m_boneBinding;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////////////////
+inline TrackCursor& Animation::getTrackCursor(unsigned long index)
 {
-	assert(index < m_boneIds.size());
-	return m_boneIds[index];
+	assert(index < m_trackCursors.size());
+	return m_trackCursors[index];
 }
 
 //////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1,23 +1,79 @@
 #include "Precompiled.h"
 #include "AnimationFile.h"
 #include "ChunkFileIo.h"
+#include "SkeletonFile.h"
 #include "Performance.h"
 #include "Spline.h"
 #include "SplineSampler.h"
+#include "LinearSampler.h"
 
 namespace grp
 {
 
-static const int CURRENT_VERSION = 0x0100;
+static const int CURRENT_VERSION = 0x0101;
+static const int VERSION_BIND_POSE_OMITTED = 0x0101;
+static const int BAKE_VERSION = 0x0100;
+static const float BOUNDING_TRACK_FPS = 10.0f;
 
-extern void decompressQuaternion(Quaternion& q, unsigned long compressed);
+extern unsigned long compressQuaternion(const Quaternion& q);
 extern AnimationSampleType g_animationSampleType;
+extern bool g_compressAnimation;
+extern bool g_bakeBoundingTracks;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename KeyType>
+static bool isConstantKeys(const VECTOR(KeyType)& keys)
+{
+	for (size_t i = 1; i < keys.size(); ++i)
+	{
+		if (memcmp(&keys[i].transform, &keys[0].transform, sizeof(keys[0].transform)) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static size_t appendData(VECTOR(unsigned char)& buffer, const void* data, size_t size)
+{
+	size_t offset = buffer.size();
+	buffer.resize(offset + size);
+	memcpy(&buffer[offset], data, size);
+	return offset;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename KeyType, typename TransformType>
+static bool hasValidKnots(const VECTOR(KeyType)& keys, const VECTOR(TransformType)& knots)
+{
+	return (knots.size() == ((keys.size() < 2) ? 0 : (keys.size() - 1) * 2));
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 AnimationFile::AnimationFile()
 	: m_duration(0.0f)
 	, m_fps(30.0f)
+	, m_bindPoseOmitted(false)
+	, m_bakedKnots(false)
+	, m_bakedFrames(false)
+	, m_frameCount(0)
+	, m_frameStride(0)
+	, m_constantSize(0)
+{
+#ifdef _GRP_WIN32_THREAD_SAFE
+	::InitializeCriticalSection(&m_cs);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+AnimationFile::~AnimationFile()
 {
+	//animations hold their resource, so every binding is dropped by now
+	assert(m_boneBindings.empty());
+#ifdef _GRP_WIN32_THREAD_SAFE
+	::DeleteCriticalSection(&m_cs);
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -40,6 +96,7 @@ bool AnimationFile::importFrom(std::istream& input)
 	}
 	input.read((char*)&version, sizeof(version));
 	fileSizeLeft -= sizeof(version);
+	m_bindPoseOmitted = (version >= VERSION_BIND_POSE_OMITTED);
 
 	if (!readChunk(input, 'FMRT', (char*)&m_fps, sizeof(m_fps), fileSizeLeft))
 	{
@@ -63,6 +120,7 @@ bool AnimationFile::importFrom(std::istream& input)
 	{
 		fileSizeLeft -= (sizeof(m_sampleType) + CHUNK_HEADER_SIZE);
 	}
+	AnimationSampleType fileSampleType = m_sampleType;
 	if (m_sampleType > g_animationSampleType)
 	{
 		m_sampleType = g_animationSampleType;
@@ -73,10 +131,28 @@ bool AnimationFile::importFrom(std::istream& input)
 	{
 		return false;
 	}
+	fileSizeLeft -= (allTrackSizeLeft + CHUNK_HEADER_SIZE);
 	size_t trackCount;
 	input.read((char*)&trackCount, sizeof(trackCount));
 	m_boneTracks.resize(trackCount);
 	allTrackSizeLeft -= sizeof(trackCount);
+	unsigned long tracksPos = (unsigned long)input.tellg();
+	unsigned long tracksEnd = tracksPos + allTrackSizeLeft;
+
+	//frames baked by exporter replace source keys of linear and step clips,
+	//so bake comes first and source keys are read only if it's missing or bad.
+	//spline clips have knots baked only, and resample their source keys if downgraded
+	size_t bakeSize;
+	if (fileSampleType != SAMPLE_SPLINE)
+	{
+		input.seekg(tracksEnd);
+		if (findChunk(input, 'BAKE', bakeSize, fileSizeLeft)
+			&& !importBakedTracks(input, bakeSize))
+		{
+			return false;
+		}
+		input.seekg(tracksPos);
+	}
 
 	for (size_t i = 0; i < trackCount; ++i)
 	{
@@ -94,6 +170,11 @@ bool AnimationFile::importFrom(std::istream& input)
 		{
 			return false;
 		}
+		if (m_bakedFrames)
+		{
+			input.seekg(trackSizeLeft, std::ios::cur);
+			continue;
+		}
 		size_t keySize;
 		//position keys
 		if (findChunk(input, 'TRAN', keySize, trackSizeLeft))
@@ -137,20 +218,364 @@ bool AnimationFile::importFrom(std::istream& input)
 			input.read((char*)&boneTrack.scaleKeys[0], keySize);
 		}
 	}
+	//knots computed by exporter need source keys
+	input.seekg(tracksEnd);
+	if (m_sampleType == SAMPLE_SPLINE
+		&& findChunk(input, 'BAKE', bakeSize, fileSizeLeft)
+		&& !importBakedTracks(input, bakeSize))
+	{
+		return false;
+	}
 	extract();
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//spline clips read knots of their source keys, others read frames before source keys are
+//imported, a bad bake leaves keys empty so that source keys are read instead
+bool AnimationFile::importBakedTracks(std::istream& input, size_t bakeSizeLeft)
+{
+	int bakeVersion;
+	size_t frameCount;
+	if (bakeSizeLeft < sizeof(bakeVersion) + sizeof(frameCount))
+	{
+		return false;
+	}
+	input.read((char*)&bakeVersion, sizeof(bakeVersion));
+	input.read((char*)&frameCount, sizeof(frameCount));
+	bakeSizeLeft -= (sizeof(bakeVersion) + sizeof(frameCount));
+	if (bakeVersion != BAKE_VERSION
+		|| frameCount != static_cast<size_t>(m_duration * m_fps) + 1)
+	{
+		//unknown bake, compute everything at load time
+		return true;
+	}
+	bool readKnots = (m_sampleType == SAMPLE_SPLINE);
+	bool knotsFound = true;
+	bool framesFound = true;
+	for (size_t i = 0; i < m_boneTracks.size(); ++i)
+	{
+		BoneTrack& boneTrack = m_boneTracks[i];
+		size_t trackSize;
+		if (!findChunk(input, 'BTRK', trackSize, bakeSizeLeft))
+		{
+			return false;
+		}
+		bakeSizeLeft -= (trackSize + CHUNK_HEADER_SIZE);
+		unsigned long trackEnd = (unsigned long)input.tellg() + trackSize;
+		if (readKnots)
+		{
+			knotsFound = knotsFound
+						&& importBakedKeys(input, 'PKNT', boneTrack.positionKnots, trackEnd)
+						&& importBakedKeys(input, 'RKNT', boneTrack.rotationKnots, trackEnd)
+						&& importBakedKeys(input, 'SKNT', boneTrack.scaleKnots, trackEnd)
+						&& hasValidKnots(boneTrack.positionKeys, boneTrack.positionKnots)
+						&& hasValidKnots(boneTrack.rotationKeys, boneTrack.rotationKnots)
+						&& hasValidKnots(boneTrack.scaleKeys, boneTrack.scaleKnots);
+		}
+		else
+		{
+			framesFound = framesFound
+						&& importBakedFrames(input, 'PFRM', boneTrack.positionKeys, trackEnd)
+						&& importBakedRotationFrames(input, boneTrack.rotationKeys, trackEnd)
+						&& importBakedFrames(input, 'SFRM', boneTrack.scaleKeys, trackEnd);
+		}
+		input.seekg(trackEnd);
+	}
+	if (!readKnots && !framesFound)
+	{
+		for (size_t i = 0; i < m_boneTracks.size(); ++i)
+		{
+			BoneTrack& boneTrack = m_boneTracks[i];
+			boneTrack.positionKeys.clear();
+			boneTrack.rotationKeys.clear();
+			boneTrack.scaleKeys.clear();
+		}
+	}
+	m_bakedKnots = (readKnots && knotsFound);
+	m_bakedFrames = (!readKnots && framesFound);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+const BoneBinding& AnimationFile::grabBoneBinding(const SkeletonFile& skeleton) const
+{
+	{
+		SCOPE_LOCK;
+
+		MAP(unsigned long, SharedBinding)::iterator found = m_boneBindings.find(skeleton.getSerial());
+		if (found != m_boneBindings.end())
+		{
+			++found->second.users;
+			return found->second.binding;
+		}
+	}
+	//built outside the lock, other animations of this file shouldn't wait for the bake
+	BoneBinding binding;
+	buildBoneBinding(skeleton, binding);
+	if (g_bakeBoundingTracks)
+	{
+		bakeBoundingTrack(skeleton, binding);
+	}
+
+	SCOPE_LOCK;
+
+	MAP(unsigned long, SharedBinding)::iterator found = m_boneBindings.find(skeleton.getSerial());
+	if (found != m_boneBindings.end())
+	{	//built by another thread meanwhile
+		++found->second.users;
+		return found->second.binding;
+	}
+	SharedBinding& shared = m_boneBindings[skeleton.getSerial()];
+	shared.users = 1;
+	shared.binding = binding;
+	return shared.binding;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AnimationFile::dropBoneBinding(const BoneBinding& binding) const
+{
+	SCOPE_LOCK;
+
+	MAP(unsigned long, SharedBinding)::iterator found = m_boneBindings.find(binding.skeletonSerial);
+	assert(found != m_boneBindings.end() && &found->second.binding == &binding);
+	assert(found->second.users > 0);
+	if (--found->second.users == 0)
+	{
+		m_boneBindings.erase(found);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AnimationFile::buildBoneBinding(const SkeletonFile& skeleton, BoneBinding& binding) const
+{
+	binding.skeletonSerial = skeleton.getSerial();
+	binding.tracks.clear();
+	binding.boneIds.clear();
+	for (size_t i = 0; i < m_boneTracks.size(); ++i)
+	{
+		int boneId = skeleton.getBoneId(m_boneTracks[i].boneName);
+		if (boneId >= 0)
+		{
+			binding.tracks.push_back(static_cast<int>(i));
+			binding.boneIds.push_back(boneId);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//linear between keys of any spacing, spline clips come out a little off between keys
+template<typename T>
+static void sampleKeys(const VECTOR(TransformKey<T>)& keys, float time, T& out)
+{
+	assert(!keys.empty());
+	if (time <= keys.front().time)
+	{
+		out = keys.front().transform;
+		return;
+	}
+	if (time >= keys.back().time)
+	{
+		out = keys.back().transform;
+		return;
+	}
+	size_t before = 0;
+	size_t after = keys.size() - 1;
+	while (before < after - 1)
+	{
+		size_t middle = (before + after) / 2;
+		if (time < keys[middle].time)
+		{
+			after = middle;
+		}
+		else
+		{
+			before = middle;
+		}
+	}
+	float factor = (time - keys[before].time) / (keys[after].time - keys[before].time);
+	out = keys[before].transform.getLerp(keys[after].transform, factor);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool AnimationFile::sampleTrack(size_t track, float time, Vector3& position, Quaternion& rotation, Vector3& scale) const
+{
+	if (isPacked())
+	{
+		const PackedTrack& packedTrack = m_packedTracks[track];
+		if (!m_bindPoseOmitted
+			&& (packedTrack.position.type == CHANNEL_NONE || packedTrack.rotation.type == CHANNEL_NONE))
+		{
+			return false;
+		}
+		size_t frame;
+		float factor;
+		getFrame(time, frame, factor);
+		if (m_sampleType == SAMPLE_STEP)
+		{
+			factor = 0.0f;
+		}
+		if (packedTrack.position.type != CHANNEL_NONE)
+		{
+			LinearSampler::sample(*this, packedTrack.position, frame, factor, position);
+		}
+		if (packedTrack.rotation.type != CHANNEL_NONE)
+		{
+			LinearSampler::sample(*this, packedTrack.rotation, frame, factor, rotation);
+			rotation.normalize();
+		}
+		if (packedTrack.scale.type != CHANNEL_NONE)
+		{
+			LinearSampler::sample(*this, packedTrack.scale, frame, factor, scale);
+		}
+		return true;
+	}
+	const BoneTrack& boneTrack = m_boneTracks[track];
+	if (!m_bindPoseOmitted
+		&& (boneTrack.positionKeys.empty() || boneTrack.rotationKeys.empty()))
+	{
+		return false;
+	}
+	if (!boneTrack.positionKeys.empty())
+	{
+		sampleKeys(boneTrack.positionKeys, time, position);
+	}
+	if (!boneTrack.rotationKeys.empty())
+	{
+		sampleKeys(boneTrack.rotationKeys, time, rotation);
+		rotation.normalize();
+	}
+	if (!boneTrack.scaleKeys.empty())
+	{
+		sampleKeys(boneTrack.scaleKeys, time, scale);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//whole clip is sampled once when the binding is built, so box queries only look it up.
+//opt-in, see enableBoundingTracks
+void AnimationFile::bakeBoundingTrack(const SkeletonFile& skeleton, BoneBinding& binding) const
+{
+	PERF_NODE_FUNC();
+
+	BoundingTrack& boundingTrack = binding.boundingTrack;
+	boundingTrack.boxes.clear();
+	float fps = (m_fps > 0.0f && m_fps < BOUNDING_TRACK_FPS) ? m_fps : BOUNDING_TRACK_FPS;
+	boundingTrack.interval = 1.0f / fps;
+
+	const VECTOR(CoreBone)& coreBones = skeleton.getCoreBones();
+	const VECTOR(int)& order = skeleton.getUpdateOrder();
+	if (order.empty())
+	{
+		return;
+	}
+	size_t boneCount = coreBones.size();
+	VECTOR(Vector3) positions(boneCount);
+	VECTOR(Quaternion) rotations(boneCount);
+	VECTOR(Vector3) scales(boneCount);
+	VECTOR(Matrix) transforms(boneCount);
+	VECTOR(Vector3) lastOrigins(boneCount);
+
+	size_t boxCount = static_cast<size_t>(ceil(m_duration * fps)) + 1;
+	boundingTrack.boxes.resize(boxCount);
+	//farthest a bone origin moves between sample i and its neighbours
+	VECTOR(float) pads(boxCount, 0.0f);
+	for (size_t i = 0; i < boxCount; ++i)
+	{
+		float time = i * boundingTrack.interval;
+		if (time > m_duration)
+		{
+			time = m_duration;
+		}
+		for (size_t bone = 0; bone < boneCount; ++bone)
+		{
+			positions[bone] = coreBones[bone].position;
+			rotations[bone] = coreBones[bone].rotation;
+			scales[bone] = coreBones[bone].scale;
+		}
+		for (size_t j = 0; j < binding.tracks.size(); ++j)
+		{
+			int boneId = binding.boneIds[j];
+			Vector3 position = positions[boneId];
+			Quaternion rotation = rotations[boneId];
+			Vector3 scale = scales[boneId];
+			if (sampleTrack(binding.tracks[j], time, position, rotation, scale))
+			{
+				positions[boneId] = position;
+				rotations[boneId] = rotation;
+				scales[boneId] = scale;
+			}
+		}
+		AaBox& box = boundingTrack.boxes[i];
+		for (size_t j = 0; j < order.size(); ++j)
+		{
+			int id = order[j];
+			Matrix local;
+			local.setTransform(positions[id], rotations[id], scales[id]);
+			int parentId = coreBones[id].parentId;
+			if (parentId < 0)
+			{
+				transforms[id] = local;
+			}
+			else
+			{
+				local.multiply_optimized(transforms[parentId], transforms[id]);
+			}
+			Vector3 origin = transforms[id].getTranslation();
+			if (j == 0)
+			{
+				box.reset(origin);
+			}
+			else
+			{
+				box.addInternalPoint(origin);
+			}
+			if (i > 0)
+			{
+				float move = origin.distance(lastOrigins[id]);
+				pads[i - 1] = std::max(pads[i - 1], move);
+				pads[i] = std::max(pads[i], move);
+			}
+			lastOrigins[id] = origin;
+		}
+	}
+	//an origin between two samples stays within the move from either of them
+	for (size_t i = 0; i < boxCount; ++i)
+	{
+		Vector3 extent(pads[i], pads[i], pads[i]);
+		boundingTrack.boxes[i].MinEdge -= extent;
+		boundingTrack.boxes[i].MaxEdge += extent;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void AnimationFile::clear()
 {
 	m_boneTracks.clear();
+	m_packedTracks.clear();
+	m_packedData.clear();
+	m_bakedKnots = false;
+	m_bakedFrames = false;
+	m_frameCount = 0;
+	m_frameStride = 0;
+	m_constantSize = 0;
+	assert(m_boneBindings.empty());
 }
 
 void AnimationFile::extract()
 {
 	//PERF_NODE_FUNC();
 
+	if (m_bakedKnots)
+	{
+		return;
+	}
+	if (m_bakedFrames)
+	{
+		pack();
+		return;
+	}
 	for (size_t i = 0; i < m_boneTracks.size(); ++i)
 	{
 		BoneTrack& boneTrack = m_boneTracks[i];
@@ -213,6 +638,223 @@ void AnimationFile::extract()
 			boneTrack.scaleKnots.clear();
 		}
 	}
+	if (m_sampleType == SAMPLE_LINEAR
+		|| m_sampleType == SAMPLE_STEP)
+	{
+		pack();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AnimationFile::pack()
+{
+	m_frameCount = static_cast<size_t>(m_duration * m_fps) + 1;
+	m_frameStride = 0;
+	m_packedTracks.resize(m_boneTracks.size());
+
+	VECTOR(unsigned char) constantData;
+	for (size_t i = 0; i < m_boneTracks.size(); ++i)
+	{
+		const BoneTrack& boneTrack = m_boneTracks[i];
+		PackedTrack& packedTrack = m_packedTracks[i];
+		packChannel(boneTrack.positionKeys, packedTrack.position, constantData);
+		packChannel(boneTrack.rotationKeys, packedTrack.rotation, constantData);
+		packChannel(boneTrack.scaleKeys, packedTrack.scale, constantData);
+	}
+	//4 byte keys go first so that every key in frame stays aligned
+	for (size_t i = 0; i < m_packedTracks.size(); ++i)
+	{
+		PackedTrack& packedTrack = m_packedTracks[i];
+		layoutChannel(packedTrack.position, true);
+		layoutChannel(packedTrack.rotation, true);
+		layoutChannel(packedTrack.scale, true);
+	}
+	for (size_t i = 0; i < m_packedTracks.size(); ++i)
+	{
+		PackedTrack& packedTrack = m_packedTracks[i];
+		layoutChannel(packedTrack.position, false);
+		layoutChannel(packedTrack.rotation, false);
+		layoutChannel(packedTrack.scale, false);
+	}
+	m_frameStride = (m_frameStride + 3) & ~3;
+
+	m_constantSize = constantData.size();
+	m_packedData.resize(m_constantSize + m_frameCount * m_frameStride);
+	if (!constantData.empty())
+	{
+		memcpy(&m_packedData[0], &constantData[0], constantData.size());
+	}
+	for (size_t i = 0; i < m_boneTracks.size(); ++i)
+	{
+		BoneTrack& boneTrack = m_boneTracks[i];
+		const PackedTrack& packedTrack = m_packedTracks[i];
+		copyChannelFrames(boneTrack.positionKeys, packedTrack.position);
+		copyChannelFrames(boneTrack.rotationKeys, packedTrack.rotation);
+		copyChannelFrames(boneTrack.scaleKeys, packedTrack.scale);
+
+		//only bone name is needed from now on
+		VECTOR(Vector3Key)().swap(boneTrack.positionKeys);
+		VECTOR(QuaternionKey)().swap(boneTrack.rotationKeys);
+		VECTOR(Vector3Key)().swap(boneTrack.scaleKeys);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AnimationFile::packChannel(const VECTOR(Vector3Key)& keys, PackedChannel& channel, VECTOR(unsigned char)& constantData)
+{
+	channel.format = CHANNEL_FLOAT;
+	channel.size = sizeof(Vector3);
+	channel.offset = 0;
+	channel.rangeOffset = 0;
+	if (keys.empty())
+	{
+		channel.type = CHANNEL_NONE;
+		return;
+	}
+	if (isConstantKeys(keys))
+	{
+		channel.type = CHANNEL_CONSTANT;
+		channel.offset = appendData(constantData, &keys[0].transform, sizeof(Vector3));
+		return;
+	}
+	assert(keys.size() == m_frameCount);
+	channel.type = CHANNEL_ANIMATED;
+	if (!g_compressAnimation)
+	{
+		return;
+	}
+	//min and quantization step per component
+	Vector3 minValue = keys[0].transform;
+	Vector3 maxValue = keys[0].transform;
+	for (size_t i = 1; i < keys.size(); ++i)
+	{
+		const Vector3& value = keys[i].transform;
+		minValue.X = std::min(minValue.X, value.X);
+		minValue.Y = std::min(minValue.Y, value.Y);
+		minValue.Z = std::min(minValue.Z, value.Z);
+		maxValue.X = std::max(maxValue.X, value.X);
+		maxValue.Y = std::max(maxValue.Y, value.Y);
+		maxValue.Z = std::max(maxValue.Z, value.Z);
+	}
+	float range[6];
+	range[0] = minValue.X;
+	range[1] = minValue.Y;
+	range[2] = minValue.Z;
+	range[3] = (maxValue.X - minValue.X) / 65535.0f;
+	range[4] = (maxValue.Y - minValue.Y) / 65535.0f;
+	range[5] = (maxValue.Z - minValue.Z) / 65535.0f;
+	channel.format = CHANNEL_COMPRESSED;
+	channel.size = sizeof(unsigned short) * 3;
+	channel.rangeOffset = appendData(constantData, range, sizeof(range));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AnimationFile::packChannel(const VECTOR(QuaternionKey)& keys, PackedChannel& channel, VECTOR(unsigned char)& constantData)
+{
+	channel.format = CHANNEL_FLOAT;
+	channel.size = sizeof(Quaternion);
+	channel.offset = 0;
+	channel.rangeOffset = 0;
+	if (keys.empty())
+	{
+		channel.type = CHANNEL_NONE;
+		return;
+	}
+	if (isConstantKeys(keys))
+	{
+		channel.type = CHANNEL_CONSTANT;
+		channel.offset = appendData(constantData, &keys[0].transform, sizeof(Quaternion));
+		return;
+	}
+	assert(keys.size() == m_frameCount);
+	channel.type = CHANNEL_ANIMATED;
+	if (g_compressAnimation)
+	{
+		channel.format = CHANNEL_COMPRESSED;
+		channel.size = sizeof(unsigned long);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AnimationFile::layoutChannel(PackedChannel& channel, bool aligned)
+{
+	if (channel.type != CHANNEL_ANIMATED
+		|| ((channel.size & 3) == 0) != aligned)
+	{
+		return;
+	}
+	channel.offset = m_frameStride;
+	m_frameStride += channel.size;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AnimationFile::copyChannelFrames(const VECTOR(Vector3Key)& keys, const PackedChannel& channel)
+{
+	if (channel.type != CHANNEL_ANIMATED)
+	{
+		return;
+	}
+	const float* range = reinterpret_cast<const float*>(&m_packedData[channel.rangeOffset]);
+	for (size_t i = 0; i < m_frameCount; ++i)
+	{
+		unsigned char* frameData = &m_packedData[m_constantSize + i * m_frameStride + channel.offset];
+		const Vector3& value = keys[i].transform;
+		if (channel.format == CHANNEL_COMPRESSED)
+		{
+			unsigned short* quantized = reinterpret_cast<unsigned short*>(frameData);
+			quantized[0] = (range[3] > 0.0f) ? static_cast<unsigned short>((value.X - range[0]) / range[3] + 0.5f) : 0;
+			quantized[1] = (range[4] > 0.0f) ? static_cast<unsigned short>((value.Y - range[1]) / range[4] + 0.5f) : 0;
+			quantized[2] = (range[5] > 0.0f) ? static_cast<unsigned short>((value.Z - range[2]) / range[5] + 0.5f) : 0;
+		}
+		else
+		{
+			memcpy(frameData, &value, sizeof(Vector3));
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void AnimationFile::copyChannelFrames(const VECTOR(QuaternionKey)& keys, const PackedChannel& channel)
+{
+	if (channel.type != CHANNEL_ANIMATED)
+	{
+		return;
+	}
+	for (size_t i = 0; i < m_frameCount; ++i)
+	{
+		unsigned char* frameData = &m_packedData[m_constantSize + i * m_frameStride + channel.offset];
+		if (channel.format == CHANNEL_COMPRESSED)
+		{
+			Quaternion rotation = keys[i].transform;
+			rotation.normalize();
+			unsigned long compressed = compressQuaternion(rotation);
+			memcpy(frameData, &compressed, sizeof(compressed));
+		}
+		else
+		{
+			memcpy(frameData, &keys[i].transform, sizeof(Quaternion));
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool AnimationFile::importBakedRotationFrames(std::istream& input, VECTOR(QuaternionKey)& keys, unsigned long trackEnd)
+{
+	VECTOR(unsigned long) compressed;
+	if (!importBakedKeys(input, 'CRFM', compressed, trackEnd))
+	{
+		return false;
+	}
+	if (compressed.empty())
+	{
+		return importBakedFrames(input, 'RFRM', keys, trackEnd);
+	}
+	VECTOR(Quaternion) frames(compressed.size());
+	for (size_t i = 0; i < compressed.size(); ++i)
+	{
+		decompressQuaternion(frames[i], compressed[i]);
+	}
+	return setBakedFrames(frames, keys);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
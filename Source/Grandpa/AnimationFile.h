@@ -3,12 +3,15 @@
 
 #include "ContentFile.h"
 #include "IAnimation.h"
+#include "ChunkFileIo.h"
 #include <string>
 #include <vector>
 
 namespace grp
 {
 
+extern void decompressQuaternion(Quaternion& q, unsigned long compressed);
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 template<typename T>
 struct TransformKey
@@ -34,6 +37,60 @@ struct BoneTrack
 	VECTOR(Vector3)			scaleKnots;
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//packed layout of resampled (linear/step) clips, keys of all tracks live in one block:
+//constant channels first, then one frame after another, without key time
+enum PackedChannelType
+{
+	CHANNEL_NONE = 0,
+	CHANNEL_CONSTANT,
+	CHANNEL_ANIMATED
+};
+
+enum PackedChannelFormat
+{
+	CHANNEL_FLOAT = 0,
+	CHANNEL_COMPRESSED	//32 bit quaternion, or 3 x 16 bit vector quantized in channel range
+};
+
+struct PackedChannel
+{
+	int		type;
+	int		format;
+	size_t	size;		//bytes per key
+	size_t	offset;		//from block start if constant, from frame start if animated
+	size_t	rangeOffset;//compressed vector only, min and step of the channel, from block start
+};
+
+struct PackedTrack
+{
+	PackedChannel	position;
+	PackedChannel	rotation;
+	PackedChannel	scale;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//coarse box of bone origins in skeleton space along an animation, one box every interval seconds.
+//each box is padded by bone movement to its neighbour samples, so poses in between stay inside.
+//empty if the skeleton has no bone or baking is disabled
+struct BoundingTrack
+{
+	float			interval;
+	VECTOR(AaBox)	boxes;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//tracks of an animation that have a bone in a skeleton, tracks without bone are left out
+struct BoneBinding
+{
+	VECTOR(int)		tracks;
+	VECTOR(int)		boneIds;	//bone of each of the tracks
+	unsigned long	skeletonSerial;
+	BoundingTrack	boundingTrack;	//baked with binding, bones without track stay in bind pose
+};
+
+class SkeletonFile;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class AnimationFile : public ContentFile
 {
@@ -41,6 +98,7 @@ class AnimationFile : public ContentFile
 
 public:
 	AnimationFile();
+	~AnimationFile();
 	
 public:
 	const VECTOR(BoneTrack)& getBoneTracks() const;
@@ -53,21 +111,104 @@ public:
 
 	float getFps() const;
 
+	//empty position/rotation channel means bind pose instead of no animation
+	bool isBindPoseOmitted() const;
+
+	//packed clip, only available for linear and step sample type
+	bool isPacked() const;
+
+	const VECTOR(PackedTrack)& getPackedTracks() const;
+
+	//locate the frames around time, shared by all tracks
+	void getFrame(float time, size_t& frame, float& factor) const;
+
+	//channel data of the frame, NULL if channel is empty
+	const unsigned char* getChannelData(const PackedChannel& channel, size_t frame) const;
+
+	void decodeKey(const PackedChannel& channel, size_t frame, Vector3& out) const;
+	void decodeKey(const PackedChannel& channel, size_t frame, Quaternion& out) const;
+
+	size_t getPackedSize() const;
+
+	//built by first grab, with its bounding track if enabled, then shared by all models with
+	//the same skeleton until last drop.
+	//grab when an animation is built, not from per frame queries
+	const BoneBinding& grabBoneBinding(const SkeletonFile& skeleton) const;
+	void dropBoneBinding(const BoneBinding& binding) const;
+
 private:
 	void clear();
 
+	void buildBoneBinding(const SkeletonFile& skeleton, BoneBinding& binding) const;
+
+	void bakeBoundingTrack(const SkeletonFile& skeleton, BoneBinding& binding) const;
+
+	//local transform of a track at time, false if the track is ignored by blending
+	bool sampleTrack(size_t track, float time, Vector3& position, Quaternion& rotation, Vector3& scale) const;
+
 	template<typename KeyType, typename TransformType>
 	void getSplineKnotsForKeys(VECTOR(KeyType)& keys, VECTOR(TransformType)& knots);
 
 	void extract();
 
+	void pack();
+
+	void packChannel(const VECTOR(Vector3Key)& keys, PackedChannel& channel, VECTOR(unsigned char)& constantData);
+	void packChannel(const VECTOR(QuaternionKey)& keys, PackedChannel& channel, VECTOR(unsigned char)& constantData);
+
+	void layoutChannel(PackedChannel& channel, bool aligned);
+
+	void copyChannelFrames(const VECTOR(Vector3Key)& keys, const PackedChannel& channel);
+	void copyChannelFrames(const VECTOR(QuaternionKey)& keys, const PackedChannel& channel);
+
 	bool importCompressedRotationKeys(std::istream& input, VECTOR(QuaternionKey)& keys, size_t keySize);
 
+	bool importBakedTracks(std::istream& input, size_t bakeSizeLeft);
+
+	template<typename T>
+	bool importBakedKeys(std::istream& input, int chunkName, VECTOR(T)& keys, unsigned long trackEnd);
+
+	template<typename T>
+	bool importBakedFrames(std::istream& input, int chunkName, VECTOR(TransformKey<T>)& keys, unsigned long trackEnd);
+
+	//frames of compressed quaternions or plain ones
+	bool importBakedRotationFrames(std::istream& input, VECTOR(QuaternionKey)& keys, unsigned long trackEnd);
+
+	template<typename T>
+	bool setBakedFrames(const VECTOR(T)& frames, VECTOR(TransformKey<T>)& keys) const;
+
 private:
 	VECTOR(BoneTrack)	m_boneTracks;
 	AnimationSampleType	m_sampleType;
 	float				m_duration;
 	float				m_fps;
+	bool				m_bindPoseOmitted;
+	bool				m_bakedKnots;
+	bool				m_bakedFrames;
+
+	VECTOR(PackedTrack)	m_packedTracks;
+	VECTOR(unsigned char)	m_packedData;
+	size_t				m_frameCount;
+	size_t				m_frameStride;
+	size_t				m_constantSize;
+
+	struct SharedBinding
+	{
+		BoneBinding	binding;
+		size_t		users;
+	};
+#ifdef _GRP_WIN32_THREAD_SAFE
+	class Lock
+	{
+	public:
+		Lock(LPCRITICAL_SECTION cs) : m_cs(cs){::EnterCriticalSection(m_cs);}
+		~Lock()	{::LeaveCriticalSection(m_cs);}
+		LPCRITICAL_SECTION m_cs;
+	};
+	mutable CRITICAL_SECTION	m_cs;	//models may be built on several threads
+#endif
+	//by skeleton serial, only while an animation uses it so unloaded skeletons leave nothing behind
+	mutable MAP(unsigned long, SharedBinding)	m_boneBindings;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -102,6 +243,63 @@ void AnimationFile::getSplineKnotsForKeys(VECTOR(KeyType)& keys, VECTOR(Transfor
 	getSplineKnots(&positions[0], positions.size(), &(knots[0]), &timeArray[0], true);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//missing chunk leaves keys untouched
+template<typename T>
+bool AnimationFile::importBakedKeys(std::istream& input, int chunkName, VECTOR(T)& keys, unsigned long trackEnd)
+{
+	size_t size;
+	if (!findChunk(input, chunkName, size, trackEnd - (unsigned long)input.tellg()))
+	{
+		return true;
+	}
+	if ((size % sizeof(T)) != 0)
+	{
+		return false;
+	}
+	keys.resize(size / sizeof(T));
+	if (!keys.empty())
+	{
+		input.read((char*)&keys[0], size);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+bool AnimationFile::importBakedFrames(std::istream& input, int chunkName, VECTOR(TransformKey<T>)& keys, unsigned long trackEnd)
+{
+	VECTOR(T) frames;
+	if (!importBakedKeys(input, chunkName, frames, trackEnd))
+	{
+		return false;
+	}
+	return setBakedFrames(frames, keys);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//frames has no time, and a constant channel has only one frame. no frame is an empty channel
+template<typename T>
+bool AnimationFile::setBakedFrames(const VECTOR(T)& frames, VECTOR(TransformKey<T>)& keys) const
+{
+	if (frames.empty())
+	{
+		keys.clear();
+		return true;
+	}
+	if (frames.size() != 1 && frames.size() != static_cast<size_t>(m_duration * m_fps) + 1)
+	{
+		return false;
+	}
+	keys.resize(frames.size());
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		keys[i].time = i / m_fps;
+		keys[i].transform = frames[i];
+	}
+	return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 inline AnimationSampleType AnimationFile::getSampleType() const
 {
@@ -114,6 +312,100 @@ inline float AnimationFile::getFps() const
 	return m_fps;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool AnimationFile::isBindPoseOmitted() const
+{
+	return m_bindPoseOmitted;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool AnimationFile::isPacked() const
+{
+	return (m_frameCount > 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline const VECTOR(PackedTrack)& AnimationFile::getPackedTracks() const
+{
+	return m_packedTracks;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void AnimationFile::getFrame(float time, size_t& frame, float& factor) const
+{
+	assert(m_frameCount > 0);
+	float position = time * m_fps;
+	if (position <= 0.0f)
+	{
+		frame = 0;
+		factor = 0.0f;
+		return;
+	}
+	frame = static_cast<size_t>(position);
+	if (frame >= m_frameCount - 1)
+	{
+		frame = m_frameCount - 1;
+		factor = 0.0f;
+		return;
+	}
+	factor = position - frame;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline const unsigned char* AnimationFile::getChannelData(const PackedChannel& channel, size_t frame) const
+{
+	switch (channel.type)
+	{
+	case CHANNEL_CONSTANT:
+		return &m_packedData[channel.offset];
+	case CHANNEL_ANIMATED:
+		assert(frame < m_frameCount);
+		return &m_packedData[m_constantSize + frame * m_frameStride + channel.offset];
+	default:
+		return NULL;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void AnimationFile::decodeKey(const PackedChannel& channel, size_t frame, Vector3& out) const
+{
+	const unsigned char* data = getChannelData(channel, frame);
+	assert(data != NULL);
+	if (channel.format == CHANNEL_COMPRESSED)
+	{
+		const unsigned short* quantized = reinterpret_cast<const unsigned short*>(data);
+		const float* range = reinterpret_cast<const float*>(&m_packedData[channel.rangeOffset]);
+		out.X = range[0] + quantized[0] * range[3];
+		out.Y = range[1] + quantized[1] * range[4];
+		out.Z = range[2] + quantized[2] * range[5];
+	}
+	else
+	{
+		out = *reinterpret_cast<const Vector3*>(data);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void AnimationFile::decodeKey(const PackedChannel& channel, size_t frame, Quaternion& out) const
+{
+	const unsigned char* data = getChannelData(channel, frame);
+	assert(data != NULL);
+	if (channel.format == CHANNEL_COMPRESSED)
+	{
+		decompressQuaternion(out, *reinterpret_cast<const unsigned long*>(data));
+	}
+	else
+	{
+		out = *reinterpret_cast<const Quaternion*>(data);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline size_t AnimationFile::getPackedSize() const
+{
+	return m_packedData.size() + m_packedTracks.size() * sizeof(PackedTrack);
+}
+
 }
 
 #endif
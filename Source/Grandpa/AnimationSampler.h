@@ -4,6 +4,16 @@
 namespace grp
 {
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//key index where each channel of a track was sampled last time
+struct TrackCursor
+{
+	int	position;
+	int	rotation;
+	int	scale;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
 class AnimationSampler
 {
 protected:
@@ -28,6 +38,47 @@ protected:
 		return min;
 	}
 
+	//playback time moves a little every frame, so try keys around the cursor first
+	template<typename T>
+	static int getKeyFrameByCursor(const VECTOR(T)& keyFrames, float time, int& cursor)
+	{
+		static const int MAX_CURSOR_STEP = 4;
+
+		int last = static_cast<int>(keyFrames.size()) - 2;
+		if (cursor > last)
+		{
+			cursor = last;
+		}
+		if (cursor < 0)
+		{
+			cursor = 0;
+		}
+		if (time >= keyFrames[cursor].time)
+		{
+			for (int i = 0; i < MAX_CURSOR_STEP; ++i)
+			{
+				if (cursor == last || time < keyFrames[cursor + 1].time)
+				{
+					return cursor;
+				}
+				++cursor;
+			}
+		}
+		else
+		{
+			for (int i = 0; i < MAX_CURSOR_STEP && cursor > 0; ++i)
+			{
+				--cursor;
+				if (time >= keyFrames[cursor].time)
+				{
+					return cursor;
+				}
+			}
+		}
+		cursor = getKeyFrameByTime(keyFrames, time);
+		return cursor;
+	}
+
 };
 
 }
@@ -0,0 +1,142 @@
+#include "Precompiled.h"
+#include "BatchSampler.h"
+#include "Performance.h"
+
+namespace grp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//keys of one channel type for up to 8 tracks, component major (x of all lanes, then y...)
+//result is written back to a
+struct BatchSampler::Batch
+{
+	float	a[4][BATCH_SIZE];
+	float	b[4][BATCH_SIZE];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BatchSampler::sample(const AnimationFile& clip,
+							size_t frame,
+							float factor,
+							const int* tracks,
+							size_t trackCount,
+							PoseBuffer& pose)
+{
+	PERF_NODE_FUNC();
+
+	assert(clip.isPacked());
+	pose.resize(trackCount);
+
+	const VECTOR(PackedTrack)& packedTracks = clip.getPackedTracks();
+	const PackedChannel noChannel = { CHANNEL_NONE, CHANNEL_FLOAT, 0, 0, 0 };
+	Batch position, rotation, scale;
+	float factors[BATCH_SIZE];
+	std::fill(factors, factors + BATCH_SIZE, factor);
+	for (size_t start = 0; start < trackCount; start += BATCH_SIZE)
+	{
+		int laneCount = static_cast<int>(std::min<size_t>(trackCount - start, BATCH_SIZE));
+		bool hasScale = false;
+		for (int lane = 0; lane < BATCH_SIZE; ++lane)
+		{
+			if (lane >= laneCount)
+			{	//padding lanes, identity keeps the math clean
+				gatherVector3(clip, noChannel, frame, factor, position, lane);
+				gatherQuaternion(clip, noChannel, frame, factor, rotation, lane);
+				gatherVector3(clip, noChannel, frame, factor, scale, lane);
+				continue;
+			}
+			const PackedTrack& track = packedTracks[tracks[start + lane]];
+			gatherVector3(clip, track.position, frame, factor, position, lane);
+			gatherQuaternion(clip, track.rotation, frame, factor, rotation, lane);
+			gatherVector3(clip, track.scale, frame, factor, scale, lane);
+			hasScale |= (track.scale.type != CHANNEL_NONE);
+		}
+		if (factor > 0.0f)
+		{
+			lerpLanes(&position.a[0][0], &position.b[0][0], factors, 3, BATCH_SIZE);
+			nlerpLanes(&rotation.a[0][0], &rotation.b[0][0], factors, BATCH_SIZE);
+			if (hasScale)
+			{
+				lerpLanes(&scale.a[0][0], &scale.b[0][0], factors, 3, BATCH_SIZE);
+			}
+		}
+		for (int lane = 0; lane < laneCount; ++lane)
+		{
+			size_t index = start + lane;
+			const PackedTrack& track = packedTracks[tracks[index]];
+			unsigned char channels = 0;
+			if (track.position.type != CHANNEL_NONE)
+			{
+				pose.positions[index].set(position.a[0][lane], position.a[1][lane], position.a[2][lane]);
+				channels |= POSE_POSITION;
+			}
+			if (track.rotation.type != CHANNEL_NONE)
+			{
+				pose.rotations[index].set(rotation.a[0][lane], rotation.a[1][lane], rotation.a[2][lane], rotation.a[3][lane]);
+				channels |= POSE_ROTATION;
+			}
+			if (track.scale.type != CHANNEL_NONE)
+			{
+				pose.scales[index].set(scale.a[0][lane], scale.a[1][lane], scale.a[2][lane]);
+				channels |= POSE_SCALE;
+			}
+			pose.channels[index] = channels;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BatchSampler::gatherVector3(const AnimationFile& clip, const PackedChannel& channel,
+								size_t frame, float factor, Batch& batch, int lane)
+{
+	Vector3 a(Vector3::ZERO);
+	Vector3 b;
+	if (channel.type != CHANNEL_NONE)
+	{
+		clip.decodeKey(channel, frame, a);
+	}
+	if (channel.type == CHANNEL_ANIMATED && factor > 0.0f)
+	{
+		clip.decodeKey(channel, frame + 1, b);
+	}
+	else
+	{
+		b = a;
+	}
+	batch.a[0][lane] = a.X;
+	batch.a[1][lane] = a.Y;
+	batch.a[2][lane] = a.Z;
+	batch.b[0][lane] = b.X;
+	batch.b[1][lane] = b.Y;
+	batch.b[2][lane] = b.Z;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void BatchSampler::gatherQuaternion(const AnimationFile& clip, const PackedChannel& channel,
+									size_t frame, float factor, Batch& batch, int lane)
+{
+	Quaternion a(Quaternion::IDENTITY);
+	Quaternion b;
+	if (channel.type != CHANNEL_NONE)
+	{
+		clip.decodeKey(channel, frame, a);
+	}
+	if (channel.type == CHANNEL_ANIMATED && factor > 0.0f)
+	{
+		clip.decodeKey(channel, frame + 1, b);
+	}
+	else
+	{
+		b = a;
+	}
+	batch.a[0][lane] = a.X;
+	batch.a[1][lane] = a.Y;
+	batch.a[2][lane] = a.Z;
+	batch.a[3][lane] = a.W;
+	batch.b[0][lane] = b.X;
+	batch.b[1][lane] = b.Y;
+	batch.b[2][lane] = b.Z;
+	batch.b[3][lane] = b.W;
+}
+
+}
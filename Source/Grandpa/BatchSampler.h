@@ -0,0 +1,42 @@
+#ifndef __GRP_BATCH_SAMPLER_H__
+#define __GRP_BATCH_SAMPLER_H__
+
+#include "AnimationFile.h"
+#include "PoseBuffer.h"
+#include "Simd.h"
+
+namespace grp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//samples many tracks of a packed clip at once, keys of a batch are gathered
+//into lanes and interpolated with sse2 (or avx2 if available)
+class BatchSampler
+{
+public:
+	//tracks are indices into clip's packed tracks, pose entry i is written for tracks[i]
+	//pass factor 0 for step sampling
+	static void sample(const AnimationFile& clip,
+						size_t frame,
+						float factor,
+						const int* tracks,
+						size_t trackCount,
+						PoseBuffer& pose);
+
+private:
+	enum
+	{
+		BATCH_SIZE = SIMD_WIDTH
+	};
+	struct Batch;
+
+	static void gatherVector3(const AnimationFile& clip, const PackedChannel& channel,
+								size_t frame, float factor, Batch& batch, int lane);
+
+	static void gatherQuaternion(const AnimationFile& clip, const PackedChannel& channel,
+								size_t frame, float factor, Batch& batch, int lane);
+};
+
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include "ModelResource.h"
 #include "Model.h"
 #include "StandaloneRigidMesh.h"
+#include "PoseCache.h"
 #include "Performance.h"
 
 namespace grp
@@ -34,11 +35,21 @@ void initializeSqrtTable();
 #endif
 
 AnimationSampleType g_animationSampleType = SAMPLE_SPLINE;
+//keep linear/step animation keys quantized in memory
+bool g_compressAnimation = false;
+
+PoseCache* g_poseCache = NULL;
+
+//optional, external
+ITaskScheduler* g_taskScheduler = NULL;
+size_t g_parallelBoneCount = 0;
+
+bool g_bakeBoundingTracks = false;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool initialize(ILogger* logger, IFileLoader* fileLoader,
 				IAllocator* allocator, IResourceManager* resourceManager,
-				AnimationSampleType sampleType)
+				AnimationSampleType sampleType, bool compressAnimation)
 {
 	PERF_NODE_FUNC();
 
@@ -48,6 +59,7 @@ bool initialize(ILogger* logger, IFileLoader* fileLoader,
 	}
 
 	g_animationSampleType = sampleType;
+	g_compressAnimation = compressAnimation;
 	g_logger = logger;
 	
 	if (allocator != NULL)
@@ -72,6 +84,8 @@ bool initialize(ILogger* logger, IFileLoader* fileLoader,
 
 	g_resourceFactory = GRP_NEW ResourceFactory(g_fileLoader);
 
+	g_poseCache = GRP_NEW PoseCache;
+
 	if (resourceManager != NULL)
 	{
 		g_externalResourceManager = true;
@@ -100,6 +114,12 @@ void destroy()
 	}
 	g_initialized = false;
 
+	//cached poses hold animation resources
+	GRP_DELETE(g_poseCache);
+	g_poseCache = NULL;
+
+	g_taskScheduler = NULL;
+
 	if (!g_externalResourceManager)
 	{
 		GRP_DELETE(g_resourceManager);
@@ -267,6 +287,46 @@ void setProfiler(PerfManager* perfManager)
 #endif
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void enablePoseCache(unsigned int subframes, size_t maxPoses)
+{
+	assert(g_poseCache != NULL);
+	g_poseCache->setMaxPoses(maxPoses);
+	g_poseCache->setSubframes(subframes);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void flushPoseCache()
+{
+	assert(g_poseCache != NULL);
+	g_poseCache->flush();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void getPoseCacheCounters(unsigned long& hitCount, unsigned long& missCount, bool reset)
+{
+	assert(g_poseCache != NULL);
+	hitCount = g_poseCache->getHitCount();
+	missCount = g_poseCache->getMissCount();
+	if (reset)
+	{
+		g_poseCache->resetCounters();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void setTaskScheduler(ITaskScheduler* scheduler, size_t parallelBoneCount)
+{
+	g_taskScheduler = scheduler;
+	g_parallelBoneCount = parallelBoneCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void enableBoundingTracks(bool enable)
+{
+	g_bakeBoundingTracks = enable;
+}
+
 #ifdef GRANDPA_SQRT_TABLE
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void initializeSqrtTable()
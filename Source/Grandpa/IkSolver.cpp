@@ -2,15 +2,78 @@
 #include "IkSolver.h"
 #include "Skeleton.h"
 #include <cassert>
+#include <cfloat>
 #include "Performance.h"
 
 namespace grp
 {
 
+static const size_t FABRIK_ITERATIONS = 10;
+static const float PI = 3.14159265f;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void applyEulerLimit(const IkBoneData& boneData, Quaternion& rotation)
+{
+	if (!boneData.eulerLimit)
+	{
+		return;
+	}
+	Euler euler = (boneData.eulerType == EULER_ZXY) ?
+					rotation.getEuler_zxy() :
+					rotation.getEuler_yxz();
+	euler.yaw = std::max(euler.yaw, boneData.eulerMin.yaw);
+	euler.pitch = std::max(euler.pitch, boneData.eulerMin.pitch);
+	euler.roll = std::max(euler.roll, boneData.eulerMin.roll);
+	euler.yaw = std::min(euler.yaw, boneData.eulerMax.yaw);
+	euler.pitch = std::min(euler.pitch, boneData.eulerMax.pitch);
+	euler.roll = std::min(euler.roll, boneData.eulerMax.roll);
+	if (boneData.eulerType == EULER_ZXY)
+	{
+		rotation.setEuler_zxy(euler);
+	}
+	else
+	{
+		rotation.setEuler_yxz(euler);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//axis must be normalized
+static Vector3 rotateVector(const Vector3& v, const Vector3& axis, float angle)
+{
+	float cosine = cosf(angle);
+	float sine = sinf(angle);
+	return v * cosine + axis.cross(v) * sine + axis * (axis.dot(v) * (1.0f - cosine));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//unit vector perpendicular to v, v must not be zero
+static Vector3 getPerpendicular(const Vector3& v)
+{
+	//cross with the axis v is least aligned to
+	Vector3 axis;
+	if (fabsf(v.X) <= fabsf(v.Y) && fabsf(v.X) <= fabsf(v.Z))
+	{
+		axis.set(0.0f, v.Z, -v.Y);
+	}
+	else if (fabsf(v.Y) <= fabsf(v.Z))
+	{
+		axis.set(-v.Z, 0.0f, v.X);
+	}
+	else
+	{
+		axis.set(v.Y, -v.X, 0.0f);
+	}
+	axis.normalize();
+	return axis;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 IkSolver::IkSolver(IBone* sourceBone, const IkBoneData* data, size_t boneCount,
-					float threshold, bool keepSourceRotation)
+					float threshold, bool keepSourceRotation, IkSolverType type)
 	: m_sourceBone(sourceBone)
+	, m_type(type)
+	, m_solved(false)
 	, m_thresholdSq(threshold * threshold)
 	, m_enabled(false)
 	, m_keepSourceRotation(keepSourceRotation)
@@ -21,26 +84,108 @@ IkSolver::IkSolver(IBone* sourceBone, const IkBoneData* data, size_t boneCount,
 	{
 		m_ikBones[i] = data[i];
 	}
+
+	if (m_type == IK_SOLVER_AUTO)
+	{
+		m_type = (boneCount == 2) ? IK_SOLVER_TWO_BONE : IK_SOLVER_FABRIK;
+	}
+	if (m_type == IK_SOLVER_CCD || sourceBone == NULL || boneCount == 0)
+	{
+		m_type = IK_SOLVER_CCD;
+		return;
+	}
+	//analytic solvers need a real chain, anything else falls back to ccd
+	IBone* child = sourceBone;
+	for (size_t i = 0; i < boneCount; ++i)
+	{
+		if (data[i].bone == NULL || child->getParent() != data[i].bone)
+		{
+			m_type = IK_SOLVER_CCD;
+			return;
+		}
+		child = data[i].bone;
+	}
+	if (m_type == IK_SOLVER_TWO_BONE && boneCount != 2)
+	{
+		m_type = IK_SOLVER_FABRIK;
+	}
+	m_chain.resize(boneCount + 1);
+	for (size_t i = 0; i < boneCount; ++i)
+	{
+		m_chain[boneCount - 1 - i] = static_cast<Bone*>(data[i].bone);
+	}
+	m_chain[boneCount] = static_cast<Bone*>(sourceBone);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void IkSolver::update()
+bool IkSolver::update()
 {
 	PERF_NODE_FUNC();
 
+	m_solved = false;
 	if (!m_enabled || m_sourceBone == NULL)
 	{
-		return;
+		return false;
+	}
+	if (m_sourceBone->getAbsoluteTransform().getTranslation().distanceSq(m_targetPosition) < m_thresholdSq)
+	{
+		return false;
 	}
 
-	Matrix backupRotation;
 	if (m_keepSourceRotation)
 	{
 		//assuming there's no scale
-		backupRotation = m_sourceBone->getAbsoluteTransform();
-		backupRotation.removeTranslation();
+		m_sourceRotation = m_sourceBone->getAbsoluteTransform();
+		m_sourceRotation.removeTranslation();
 	}
 
+	switch (m_type)
+	{
+	case IK_SOLVER_TWO_BONE:
+		solveTwoBone();
+		break;
+	case IK_SOLVER_FABRIK:
+		solveFabrik();
+		break;
+	default:
+		solveCcd();
+		break;
+	}
+	m_solved = true;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void IkSolver::restoreSourceRotation()
+{
+	if (!m_solved || !m_keepSourceRotation)
+	{
+		return;
+	}
+	m_sourceRotation.setTranslation(m_sourceBone->getAbsoluteTransform().getTranslation());
+	m_sourceBone->setAbsoluteTransform(m_sourceRotation);
+	m_sourceBone->updateChildren();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void IkSolver::pinBones()
+{
+	if (m_sourceBone != NULL)
+	{
+		static_cast<Bone*>(m_sourceBone)->updateLodError(FLT_MAX);
+	}
+	for (size_t i = 0; i < m_ikBones.size(); ++i)
+	{
+		if (m_ikBones[i].bone != NULL)
+		{
+			static_cast<Bone*>(m_ikBones[i].bone)->updateLodError(FLT_MAX);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void IkSolver::solveCcd()
+{
 	size_t repeat = 5;
 	while (repeat-- > 0)
 	{
@@ -57,7 +202,7 @@ void IkSolver::update()
 
 			if (dstLocal.distanceSq(srcLocal) < m_thresholdSq)
 			{
-				goto Out;
+				return;
 			}
 			srcLocal.normalize();
 			dstLocal.normalize();
@@ -66,36 +211,207 @@ void IkSolver::update()
 			axis.normalize();
 			Quaternion rotation(axis, angle);
 			Quaternion newRotation = rotation * bone->getRotation();
-			if (boneData.eulerLimit)
+			applyEulerLimit(boneData, newRotation);
+			bone->setRotation(newRotation);
+			bone->updateTree();
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void IkSolver::solveTwoBone()
+{
+	assert(m_chain.size() == 3);
+	Vector3 upper = m_chain[0]->getAbsoluteTransform().getTranslation();
+	Vector3 middle = m_chain[1]->getAbsoluteTransform().getTranslation();
+	Vector3 end = m_chain[2]->getAbsoluteTransform().getTranslation();
+
+	float upperLength = upper.distance(middle);
+	float lowerLength = middle.distance(end);
+	if (upperLength <= 0.0f || lowerLength <= 0.0f)
+	{
+		return;
+	}
+	//keep a little bend so the middle joint never flips
+	float targetLength = upper.distance(m_targetPosition);
+	targetLength = std::max(targetLength, fabsf(upperLength - lowerLength) * 1.001f);
+	targetLength = std::min(targetLength, (upperLength + lowerLength) * 0.999f);
+
+	//open or close the middle joint until end is at target distance from upper
+	Vector3 toUpper = (upper - middle) / upperLength;
+	Vector3 toEnd = (end - middle) / lowerLength;
+	float currentAngle = acosf(std::min(std::max(toUpper.dot(toEnd), -1.0f), 1.0f));
+	float cosine = (upperLength * upperLength + lowerLength * lowerLength - targetLength * targetLength)
+					/ (2.0f * upperLength * lowerLength);
+	float desiredAngle = acosf(std::min(std::max(cosine, -1.0f), 1.0f));
+	Vector3 axis = toUpper.cross(toEnd);
+	if (axis.lengthSq() < 1e-8f)
+	{
+		//straight, bend around z axis of middle bone made perpendicular to the limb
+		const Matrix& middleTransform = m_chain[1]->getAbsoluteTransform();
+		Vector3 bendAxis(middleTransform._31, middleTransform._32, middleTransform._33);
+		axis = bendAxis - toEnd * bendAxis.dot(toEnd);
+		if (axis.lengthSq() < 1e-8f)
+		{
+			axis = getPerpendicular(toEnd);
+		}
+	}
+	axis.normalize();
+	Vector3 newEnd = middle + rotateVector(end - middle, axis, desiredAngle - currentAngle);
+	rotateToward(1, end, newEnd);
+	updateChain(1);
+
+	//then swing the whole limb onto target
+	rotateToward(0, m_chain[2]->getAbsoluteTransform().getTranslation(), m_targetPosition);
+	updateChain(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void IkSolver::solveFabrik()
+{
+	size_t count = m_chain.size();
+	assert(count >= 2);
+	m_points.resize(count);
+	m_lengths.resize(count - 1);
+	float totalLength = 0.0f;
+	for (size_t i = 0; i < count; ++i)
+	{
+		m_points[i] = m_chain[i]->getAbsoluteTransform().getTranslation();
+		if (i > 0)
+		{
+			m_lengths[i - 1] = m_points[i].distance(m_points[i - 1]);
+			totalLength += m_lengths[i - 1];
+		}
+	}
+
+	Vector3 root = m_points[0];
+	if (root.distance(m_targetPosition) >= totalLength)
+	{
+		//out of reach, stretch toward target
+		Vector3 direction = m_targetPosition - root;
+		direction.normalize();
+		for (size_t i = 1; i < count; ++i)
+		{
+			m_points[i] = m_points[i - 1] + direction * m_lengths[i - 1];
+		}
+	}
+	else
+	{
+		for (size_t iteration = 0;
+			iteration < FABRIK_ITERATIONS && m_points[count - 1].distanceSq(m_targetPosition) >= m_thresholdSq;
+			++iteration)
+		{
+			//backward from target
+			m_points[count - 1] = m_targetPosition;
+			for (size_t i = count - 1; i-- > 0; )
 			{
-				Euler euler = (boneData.eulerType == EULER_ZXY) ?
-								newRotation.getEuler_zxy() :
-								newRotation.getEuler_yxz();
-				euler.yaw = std::max(euler.yaw, boneData.eulerMin.yaw);
-				euler.pitch = std::max(euler.pitch, boneData.eulerMin.pitch);
-				euler.roll = std::max(euler.roll, boneData.eulerMin.roll);
-				euler.yaw = std::min(euler.yaw, boneData.eulerMax.yaw);
-				euler.pitch = std::min(euler.pitch, boneData.eulerMax.pitch);
-				euler.roll = std::min(euler.roll, boneData.eulerMax.roll);
-				if (boneData.eulerType == EULER_ZXY)
+				Vector3 direction = m_points[i] - m_points[i + 1];
+				if (direction.lengthSq() > 0.0f)
 				{
-					newRotation.setEuler_zxy(euler);
+					direction.normalize();
+					m_points[i] = m_points[i + 1] + direction * m_lengths[i];
 				}
-				else
+			}
+			//forward from root
+			m_points[0] = root;
+			for (size_t i = 1; i < count; ++i)
+			{
+				Vector3 direction = m_points[i] - m_points[i - 1];
+				if (direction.lengthSq() > 0.0f)
 				{
-					newRotation.setEuler_yxz(euler);
+					direction.normalize();
+					m_points[i] = m_points[i - 1] + direction * m_lengths[i - 1];
 				}
 			}
-			bone->setRotation(newRotation);
-			bone->updateTree();
 		}
 	}
-Out:
-	if (m_keepSourceRotation)
+
+	//turn solved points into rotations, root first. bone i has to see its parent's new
+	//rotation before target point is taken into its space
+	for (size_t i = 0; i + 1 < count; ++i)
+	{
+		m_chain[i]->update();
+		m_chain[i + 1]->update();
+		rotateToward(i, m_chain[i + 1]->getAbsoluteTransform().getTranslation(), m_points[i + 1]);
+		m_chain[i]->update();
+	}
+	m_chain[count - 1]->update();
+	assert(checkFabrikPoints());
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool IkSolver::checkFabrikPoints() const
+{
+	//euler limits may keep chain from reaching solved points
+	for (size_t i = 0; i < m_ikBones.size(); ++i)
+	{
+		if (m_ikBones[i].eulerLimit)
+		{
+			return true;
+		}
+	}
+	float tolerance = 0.0f;
+	for (size_t i = 0; i < m_lengths.size(); ++i)
+	{
+		tolerance += m_lengths[i];
+	}
+	tolerance = std::max(tolerance * 1e-3f, 1e-4f);
+	for (size_t i = 0; i < m_chain.size(); ++i)
+	{
+		if (m_chain[i]->getAbsoluteTransform().getTranslation().distance(m_points[i]) > tolerance)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void IkSolver::rotateToward(size_t index, const Vector3& from, const Vector3& to)
+{
+	assert(index + 1 < m_chain.size());
+	Bone* bone = m_chain[index];
+	const Matrix& transform = bone->getAbsoluteTransform();
+	Vector3 fromLocal = transform.invTransformVector3(from);
+	Vector3 toLocal = transform.invTransformVector3(to);
+	if (fromLocal.lengthSq() <= 0.0f || toLocal.lengthSq() <= 0.0f)
+	{
+		return;
+	}
+	fromLocal.normalize();
+	toLocal.normalize();
+	Vector3 axis = fromLocal.cross(toLocal);
+	float sine = axis.length();
+	float cosine = fromLocal.dot(toLocal);
+	float angle;
+	if (sine >= 1e-6f)
+	{
+		angle = atan2f(sine, cosine);
+		axis /= sine;
+	}
+	else if (cosine > 0.0f)
+	{
+		return;	//already there
+	}
+	else
+	{
+		//opposite, half turn around any axis
+		axis = getPerpendicular(fromLocal);
+		angle = PI;
+	}
+	Quaternion rotation(axis, angle);
+	Quaternion newRotation = rotation * bone->getRotation();
+	//chain is stored root first, bone data nearest to source first
+	applyEulerLimit(m_ikBones[m_ikBones.size() - 1 - index], newRotation);
+	bone->setRotation(newRotation);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void IkSolver::updateChain(size_t first)
+{
+	for (size_t i = first; i < m_chain.size(); ++i)
 	{
-		backupRotation.setTranslation(m_sourceBone->getAbsoluteTransform().getTranslation());
-		m_sourceBone->setAbsoluteTransform(backupRotation);
-		m_sourceBone->updateChildren();
+		m_chain[i]->update();
 	}
 }
 
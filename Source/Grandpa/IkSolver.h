@@ -6,6 +6,8 @@
 namespace grp
 {
 
+class Bone;
+
 class IkSolver : public IIkSolver
 {
 public:
@@ -13,7 +15,8 @@ public:
 			  const IkBoneData* data,
 			  size_t boneCount,
 			  float threshold,
-			  bool keepSourceRotation);
+			  bool keepSourceRotation,
+			  IkSolverType type);
 
 	virtual IBone* sourceBone();
 
@@ -22,11 +25,38 @@ public:
 
 	virtual void setTarget(const Vector3& position);
 
-	void update();
+	//writes local rotations of chain, returns false if nothing changed.
+	//descendants are left to skeleton's hierarchy update
+	bool update();
+
+	//call after hierarchy update
+	void restoreSourceRotation();
+
+	//raises lod error of source and chain bones so that skeleton lod never prunes them
+	void pinBones();
+
+private:
+	void solveCcd();
+	void solveTwoBone();
+	void solveFabrik();
+
+	//rotates bone so that point from is moved toward point to, both in skeleton space
+	void rotateToward(size_t index, const Vector3& from, const Vector3& to);
+
+	void updateChain(size_t first);
+
+	//debug check that written rotations put every chain bone on its solved point
+	bool checkFabrikPoints() const;
 
 private:
 	IBone*				m_sourceBone;
 	VECTOR(IkBoneData)	m_ikBones;
+	IkSolverType		m_type;
+	VECTOR(Bone*)		m_chain;		//root of chain first, source last
+	VECTOR(Vector3)		m_points;		//fabrik scratch
+	VECTOR(float)		m_lengths;
+	Matrix				m_sourceRotation;
+	bool				m_solved;
 	Vector3				m_targetPosition;
 	float				m_thresholdSq;
 	bool				m_enabled;
@@ -37,7 +37,23 @@ void LinearSampler::sample(const VECTOR(TransformKey<T>)& keyFrames, float time,
 	out = frameBefore.transform.getLerp(frameAfter.transform, blendFactor);
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+void LinearSampler::sample(const AnimationFile& clip, const PackedChannel& channel, size_t frame, float factor, T& out)
+{
+	clip.decodeKey(channel, frame, out);
+	if (channel.type == CHANNEL_CONSTANT || factor <= 0.0f)
+	{
+		return;
+	}
+	T frameAfter;
+	clip.decodeKey(channel, frame + 1, frameAfter);
+	out = out.getLerp(frameAfter, factor);
+}
+
 template void LinearSampler::sample<Vector3>(const VECTOR(TransformKey<Vector3>)&, float, float, Vector3&);
 template void LinearSampler::sample<Quaternion>(const VECTOR(TransformKey<Quaternion>)&, float, float, Quaternion&);
+template void LinearSampler::sample<Vector3>(const AnimationFile&, const PackedChannel&, size_t, float, Vector3&);
+template void LinearSampler::sample<Quaternion>(const AnimationFile&, const PackedChannel&, size_t, float, Quaternion&);
 
 }
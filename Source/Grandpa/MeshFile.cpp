@@ -497,15 +497,15 @@ size_t MeshFile::calculateVertexStride(unsigned long format)
 	size_t stride = 0;
 	if ((format & POSITION) != 0)
 	{
-		stride += sizeof(Vector3);
+		stride += getDataSize(format, POSITION);
 	}
 	if ((format & NORMAL) != 0)
 	{
-		stride += sizeof(Vector3);
+		stride += getDataSize(format, NORMAL);
 	}
 	if ((format & TANGENT) != 0)
 	{
-		stride += (2 * sizeof(Vector3));
+		stride += getDataSize(format, TANGENT);
 	}
 	if ((format & TEXCOORD) != 0)
 	{
@@ -529,19 +529,22 @@ size_t MeshFile::getDataOffset(unsigned long format, unsigned long field)
 	{
 		return 0xffffffff;
 	}
+	size_t positionSize = getDataSize(format, POSITION);
+	size_t normalSize = getDataSize(format, NORMAL);
 	if (field == POSITION)
 	{
 		return 0;
 	}
 	if (field == NORMAL)
 	{
-		return sizeof(Vector3);
+		return positionSize;
 	}
 	if (field == TANGENT)
 	{
-		//must have normal if there's tangent
-		return sizeof(Vector3) * 2;
+		//must have normal if there's tangent, quaternion frame shares normal's place
+		return ((format & TANGENT_QUAT) != 0) ? positionSize : positionSize + normalSize;
 	}
+	size_t tangentSize = getDataSize(format, TANGENT);
 	if (field == TEXCOORD)
 	{
 		if ((format & POSITION) == 0)
@@ -550,14 +553,14 @@ size_t MeshFile::getDataOffset(unsigned long format, unsigned long field)
 		}
 		if ((format & NORMAL) == 0)
 		{
-			return sizeof(Vector3);
+			return positionSize;
 		}
 		if ((format & TANGENT) == 0)
 		{
-			return sizeof(Vector3) * 2;
+			return positionSize + normalSize;
 		}
 		//must have binormal if there's tangent
-		return sizeof(Vector3) * 4;
+		return positionSize + normalSize + tangentSize;
 	}
 	if (field == TEXCOORD2)
 	{
@@ -568,16 +571,47 @@ size_t MeshFile::getDataOffset(unsigned long format, unsigned long field)
 		//must have TEXCOORD if there's TEXCOORD2
 		if ((format & NORMAL) == 0)
 		{
-			return sizeof(Vector3) + sizeof(Vector2);
+			return positionSize + sizeof(Vector2);
 		}
 		if ((format & TANGENT) == 0)
 		{
-			return sizeof(Vector3) * 2 + sizeof(Vector2);
+			return positionSize + normalSize + sizeof(Vector2);
 		}
 		//must have binormal if there's tangent
-		return sizeof(Vector3) * 4 + sizeof(Vector2);
+		return positionSize + normalSize + tangentSize + sizeof(Vector2);
 	}
 	return 0xffffffff;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+size_t MeshFile::getDataSize(unsigned long format, unsigned long field)
+{
+	if ((format & field) == 0)
+	{
+		return 0;
+	}
+	if (field == POSITION)
+	{
+		return ((format & (POSITION_HALF | POSITION_UNORM16)) != 0)
+			? 4 * sizeof(unsigned short) : sizeof(Vector3);
+	}
+	if (field == NORMAL)
+	{
+		if ((format & TANGENT_QUAT) != 0)
+		{
+			return 4 * sizeof(short);
+		}
+		return ((format & NORMAL_OCT) != 0) ? 2 * sizeof(short) : sizeof(Vector3);
+	}
+	if (field == TANGENT)
+	{
+		if ((format & TANGENT_QUAT) != 0)
+		{
+			return 0;
+		}
+		return ((format & NORMAL_OCT) != 0) ? 4 * sizeof(short) : 2 * sizeof(Vector3);
+	}
+	return 0;
+}
+
 }
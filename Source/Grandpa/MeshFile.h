@@ -48,6 +48,9 @@ public:
 
 	static size_t getDataOffset(unsigned long format, unsigned long field);
 
+	//bytes of position, normal or tangent(with binormal) under encodings of format
+	static size_t getDataSize(unsigned long format, unsigned long field);
+
 protected:
 	void importPosition(std::istream& input, unsigned char* positionPtr, size_t stride);
 	void importCompressedPosition(std::istream& input, unsigned char* positionPtr, size_t stride);
@@ -8,15 +8,36 @@
 #include "Skeleton.h"
 #include "Animation.h"
 #include "SkinnedMesh.h"
-#include "StepSampler.h"
-#include "LinearSampler.h"
 #include "SplineSampler.h"
+#include "BatchSampler.h"
+#include "PoseCache.h"
 #include "IEventHandler.h"
 #include "Performance.h"
+#include <cfloat>
 
 namespace grp
 {
 
+extern PoseCache* g_poseCache;
+
+//spreads pose evaluation of models with the same update interval over frames
+#ifdef _GRP_WIN32_THREAD_SAFE
+static volatile LONG s_updateStagger = 0;
+#else
+static unsigned int s_updateStagger = 0;
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//models may be created by several threads
+static unsigned int nextUpdateStagger()
+{
+#ifdef _GRP_WIN32_THREAD_SAFE
+	return static_cast<unsigned int>(::InterlockedIncrement(&s_updateStagger));
+#else
+	return s_updateStagger++;
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 Model::Model(const ModelResource* resource, IEventHandler* eventHandler)
 	: m_resource(resource)
@@ -28,12 +49,16 @@ Model::Model(const ModelResource* resource, IEventHandler* eventHandler)
 	, m_skeletonLodEnabled(false)
 	, m_globalSkinning(false)
 	, m_skeletonErrorDirty(false)
+	, m_skeletonLodDirty(false)
 	, m_useFixedBoundingBox(false)
 	, m_userData(0)
 	, m_boundingBox(AaBox::EMPTY)
 	, m_transform(Matrix::IDENTITY)
 	, m_attachedTransform(Matrix::IDENTITY)
 	, m_attachedTo(NULL)
+	, m_updateInterval(1)
+	, m_updateCount(nextUpdateStagger())
+	, m_poseDirty(true)
 {
 	assert(resource != NULL);
 	resource->grab();
@@ -114,14 +139,42 @@ void Model::updateInternal(double time, float elapsedTime, unsigned long flag)
 
 	updateSyncAnimations(elapsedTime);
 
-	if ((flag & UPDATE_INVISIBLE) == 0)
+	if ((flag & UPDATE_INVISIBLE) != 0)
 	{
+		//pose will be out of date when visible again
+		m_poseDirty = true;
+	}
+	else if (isPoseDue())
+	{
+		if (m_skeleton != NULL && m_skeleton->isIkChanged())
+		{
+			//new ik chain must not be pruned
+			m_skeletonErrorDirty = true;
+		}
 		if (m_skeletonLodEnabled && m_skeletonErrorDirty)
 		{
 			updateSkeletonError();
 		}
+		if (m_skeletonLodDirty && !(m_skeletonLodEnabled && m_skeletonErrorDirty))
+		{
+			updateSkeletonLod();
+		}
+
+		updateSkeleton(true);
 
-		updateSkeleton();
+		updateParts();
+
+		if ((flag & UPDATE_NO_BOUNDING_BOX) == 0 && !m_useFixedBoundingBox)
+		{
+			updateBoundingBox();
+		}
+		m_poseTransform = getTransform();
+		m_poseDirty = false;
+	}
+	else if (m_globalSkinning && getTransform() != m_poseTransform)
+	{
+		//local pose is held, but skinned vertices are in world space and have to follow the model
+		updateSkeleton(false);
 
 		updateParts();
 
@@ -129,6 +182,7 @@ void Model::updateInternal(double time, float elapsedTime, unsigned long flag)
 		{
 			updateBoundingBox();
 		}
+		m_poseTransform = getTransform();
 	}
 
 	updateAttachments(time, elapsedTime, flag);
@@ -145,6 +199,8 @@ void Model::attach(IModel* otherModel, const Char* boneName, AttachType type, bo
 	attachment.syncAnimation = syncAnimation;
 	m_attachments.push_back(attachment);
 	static_cast<Model*>(otherModel)->m_attachedTo = this;
+	//attached bone must not be pruned
+	m_skeletonErrorDirty = true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -158,6 +214,7 @@ void Model::detach(IModel* otherModel)
 		{
 			static_cast<Model*>(iter->model)->m_attachedTo = NULL;
 			m_attachments.erase(iter);
+			m_skeletonErrorDirty = true;
 			return;
 		}
 	}
@@ -175,6 +232,7 @@ IPart* Model::setPart(const Char* slot, const IResource* resource)
 	const PartResource* partResource = static_cast<const PartResource*>(resource);
 	Part* part = GRP_NEW Part(partResource);
 	m_parts[slot] = part;
+	m_poseDirty = true;
 
 	if (m_eventHandler != NULL)
     {
@@ -296,6 +354,8 @@ IAnimation* Model::playAnimation(const Char* slot,
 									float fadeoutTime)
 {
 	IAnimation* animation = playSelfAnimation(slot, mode, priority, syncGroup, fadeinTime, fadeoutTime);
+	//new clip shows on next update, not when interval is due
+	m_poseDirty = true;
 
 	//play animation on attachments
 	for (LIST(Attachment)::iterator iter = m_attachments.begin();
@@ -332,6 +392,7 @@ bool Model::stopAnimation(const Char* slot, float fadeoutTime)
 	if (animation != NULL)
 	{
 		animation->stop(fadeoutTime);
+		m_poseDirty = true;
 		return true;
 	}
 	return false;
@@ -340,6 +401,7 @@ bool Model::stopAnimation(const Char* slot, float fadeoutTime)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Model::stopAllAnimations(float fadeoutTime)
 {
+	m_poseDirty = true;
 	if (fadeoutTime > 0.0f)
 	{
 		for (LIST(Animation*)::iterator iter = m_animations.begin();
@@ -597,6 +659,7 @@ void Model::updateAnimations(float elapsedTime)
 			iter = m_animations.erase(iter);
 			removeAnimationFromSyncGroup(animation);
 			GRP_DELETE(animation);
+			m_poseDirty = true;
 		}
 		else
 		{
@@ -606,7 +669,19 @@ void Model::updateAnimations(float elapsedTime)
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Model::updateSkeleton()
+bool Model::isPoseDue()
+{
+	++m_updateCount;
+	if (m_poseDirty || m_updateInterval <= 1)
+	{
+		return true;
+	}
+	return (m_updateCount % m_updateInterval == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//blend = false keeps local pose of bones and only updates hierarchy
+void Model::updateSkeleton(bool blend)
 {
 	PERF_NODE_FUNC();
 
@@ -632,9 +707,9 @@ void Model::updateSkeleton()
 		m_skeleton->setTransform(Matrix::IDENTITY);
 	}
 
-	if (!m_animations.empty())
+	if (blend && !m_animations.empty())
 	{
-		m_skeleton->reset();
+		m_skeleton->resetBlend();
 
 		int lastPriority = m_animations.front()->getPriority();
 
@@ -652,7 +727,7 @@ void Model::updateSkeleton()
 			{
 				//lock transform when priority change
 				lastPriority = animation->getPriority();
-				m_skeleton->lockTransform();
+				m_skeleton->lockBlend();
 			}
 			if (animation->getAnimationResource()->getSampleType() == SAMPLE_SPLINE)
 			{
@@ -663,7 +738,7 @@ void Model::updateSkeleton()
 				blendAnimation(animation);
 			}
 		}
-		m_skeleton->lockTransform();
+		m_skeleton->applyBlend();
 	}
 
 	m_skeleton->update();
@@ -716,7 +791,7 @@ void Model::updateBoundingBox()
 		{
 			continue;
 		}
-		if (mesh->getSkin() != NULL && !mesh->getSkin()->isGpuSkinning())
+		if (mesh->getSkin() != NULL)
 		{
 			mesh->calculateBoundingBox();
 		}
@@ -744,6 +819,10 @@ void Model::updateBoundingBoxBySkeleton()
 	size_t boneCount = m_skeleton->getBoneCount();
 	for (size_t i = 0; i < boneCount; ++i)
 	{
+		if (!m_skeleton->isBoneActive(static_cast<int>(i)))
+		{	//pruned by lod, transform is out of date
+			continue;
+		}
 		IBone* bone = m_skeleton->getBoneById(i);
 		if (bone != NULL)
 		{
@@ -761,6 +840,107 @@ void Model::updateBoundingBoxBySkeleton()
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Model::predictBoundingBox(AaBox& box) const
+{
+	if (m_useFixedBoundingBox)
+	{
+		box = m_boundingBox;
+		return true;
+	}
+	if (m_skeleton == NULL)
+	{
+		return false;
+	}
+	bool first = true;
+	for (LIST(Animation*)::const_iterator iter = m_animations.begin();
+		iter != m_animations.end();
+		++iter)
+	{
+		const Animation* animation = *iter;
+		if (!animation->isBuilt())
+		{
+			continue;
+		}
+		float sampleTime = animation->getSampleTime();
+		if (sampleTime != sampleTime)
+		{	//invalid float
+			continue;
+		}
+		const BoundingTrack& track = animation->getBoneBinding().boundingTrack;
+		if (track.boxes.empty())
+		{
+			continue;
+		}
+		//boxes on both sides cover the pose until next bake time
+		size_t last = track.boxes.size() - 1;
+		size_t before = (sampleTime > 0.0f) ? static_cast<size_t>(sampleTime / track.interval) : 0;
+		if (before > last)
+		{
+			before = last;
+		}
+		size_t after = (before < last) ? before + 1 : last;
+		if (first)
+		{
+			box = track.boxes[before];
+			first = false;
+		}
+		else
+		{
+			box.addInternalBox(track.boxes[before]);
+		}
+		box.addInternalBox(track.boxes[after]);
+	}
+	if (first)
+	{
+		return false;
+	}
+	float radius = getSkinRadius();
+	Vector3 extent(radius, radius, radius);
+	box.MinEdge -= extent;
+	box.MaxEdge += extent;
+	if (m_globalSkinning)
+	{
+		box = getTransform().transformBox(box);
+	}
+	//rigid meshes keep the box of last update
+	for (MAP(STRING, Part*)::const_iterator iter = m_parts.begin();
+		iter != m_parts.end();
+		++iter)
+	{
+		Mesh* mesh = static_cast<Mesh*>(iter->second->getMesh());
+		if (mesh != NULL && mesh->isBuilt() && mesh->getSkin() == NULL)
+		{
+			box.addInternalBox(mesh->getBoundingBox());
+		}
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//farthest any skinned vertex gets from its bones
+float Model::getSkinRadius() const
+{
+	float radius = 0.0f;
+	for (MAP(STRING, Part*)::const_iterator iter = m_parts.begin();
+		iter != m_parts.end();
+		++iter)
+	{
+		Mesh* mesh = static_cast<Mesh*>(iter->second->getMesh());
+		if (mesh == NULL || !mesh->isBuilt() || mesh->getSkin() == NULL)
+		{
+			continue;
+		}
+		const SkinnedMeshResource* meshResource = static_cast<const SkinnedMeshResource*>(mesh->getMeshResource());
+		const VECTOR(float)& distances = meshResource->getBoneMaxDistances();
+		for (size_t i = 0; i < distances.size(); ++i)
+		{
+			radius = std::max(radius, distances[i]);
+		}
+	}
+	return radius;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Model::updateAttachments(double time, float elapsedTime, unsigned long flag)
 {
@@ -823,6 +1003,16 @@ void Model::updateSkeletonError()
 		Part* part= iter->second;
 		if (!part->isSkinnedPart())
 		{
+			//rigid mesh follows its bone, which must not be pruned
+			const RigidMeshResource* meshResource = static_cast<const RigidMeshResource*>(part->getPartResource()->getMeshResource());
+			if (meshResource != NULL && !meshResource->getAttachedBoneName().empty())
+			{
+				int boneId = m_skeleton->getBoneId(meshResource->getAttachedBoneName());
+				if (boneId >= 0)
+				{
+					m_skeleton->getBone(boneId)->updateLodError(FLT_MAX);
+				}
+			}
 			continue;
 		}
 		const SkinnedMesh* skinnedMesh = static_cast<const SkinnedMesh*>(part->getMesh());
@@ -843,7 +1033,66 @@ void Model::updateSkeletonError()
 			bone->updateLodError(distances[i]);
 		}
 	}
+	for (LIST(Attachment)::iterator iter = m_attachments.begin();
+		iter != m_attachments.end();
+		++iter)
+	{
+		int boneId = m_skeleton->getBoneId(iter->boneName);
+		if (boneId >= 0)
+		{
+			m_skeleton->getBone(boneId)->updateLodError(FLT_MAX);
+		}
+	}
+	m_skeleton->pinIkBones();
 	m_skeletonErrorDirty = false;
+	m_skeletonLodDirty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Model::updateSkeletonLod()
+{
+	PERF_NODE_FUNC();
+
+	if (m_skeleton == NULL)
+	{
+		m_skeletonLodDirty = false;
+		return;
+	}
+	if (!m_skeleton->isBuilt())
+	{
+		return;
+	}
+	m_skeleton->setLodTolerance(m_skeletonLodEnabled ? m_lodTolerance : 0.0f);
+
+	//skins of pruned bones follow the surviving ancestors
+	for (MAP(STRING, Part*)::iterator iter = m_parts.begin();
+		iter != m_parts.end();
+		++iter)
+	{
+		Part* part= iter->second;
+		if (!part->isSkinnedPart() || !part->isBuilt())
+		{
+			continue;
+		}
+		SkinnedMesh* skinnedMesh = static_cast<SkinnedMesh*>(part->getMesh());
+		if (skinnedMesh == NULL || !skinnedMesh->isBuilt())
+		{
+			continue;
+		}
+		const VECTOR(int)& boneIds = skinnedMesh->getBoneIds();
+		for (size_t i = 0; i < boneIds.size(); ++i)
+		{
+			int boneId = boneIds[i];
+			if (boneId < 0)
+			{
+				continue;
+			}
+			int lodParent = m_skeleton->getLodParent(boneId);
+			const Matrix* matrix = &(m_skeleton->getBone(lodParent)->getAbsoluteTransform());
+			skinnedMesh->setBoneLod(i, lodParent, matrix, (lodParent == boneId) ? NULL : &m_skeleton->getCollapseTransform(boneId));
+		}
+	}
+	m_skeletonLodDirty = false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -861,55 +1110,78 @@ void Model::blendAnimation(Animation* animation)
 		return;
 	}
 	const AnimationResource* animationResource = animation->getAnimationResource();
-	float fps = animationResource->getFps();
-	const VECTOR(BoneTrack)& boneTracks = animationResource->getBoneTracks();
-	for (size_t i = 0; i < boneTracks.size(); ++i)
-	{
-		int boneId = animation->getBoneId(i);
-		Bone* bone = (boneId < 0) ? NULL : m_skeleton->getBone(boneId);
-		if (bone == NULL || !bone->hasWeightLeft())	//all weight has been taken, no need to blend any more
+	assert(animationResource->isPacked());
+	size_t frame;
+	float factor;
+	animationResource->getFrame(sampleTime, frame, factor);
+	bool step = (animationResource->getSampleType() == SAMPLE_STEP);
+	bool bindPoseOmitted = animationResource->isBindPoseOmitted();
+
+	const VECTOR(PackedTrack)& packedTracks = animationResource->getPackedTracks();
+	const BoneBinding& binding = animation->getBoneBinding();
+	m_activeTracks.clear();
+	m_poseBones.clear();
+	for (size_t i = 0; i < binding.tracks.size(); ++i)
+	{
+		int boneId = binding.boneIds[i];
+		if (!m_skeleton->hasWeightLeft(boneId))	//all weight has been taken, no need to blend any more
 		{
 			continue;
 		}
-		if (m_skeletonLodEnabled && m_lodTolerance > bone->getLodError())
+		if (!m_skeleton->isBoneActive(boneId))	//pruned by skeleton lod
 		{
 			continue;
 		}
-		const BoneTrack& track = boneTracks[i];
-		if (track.positionKeys.empty() || track.rotationKeys.empty())
+		const PackedTrack& track = packedTracks[binding.tracks[i]];
+		if (!bindPoseOmitted
+			&& (track.position.type == CHANNEL_NONE || track.rotation.type == CHANNEL_NONE))
 		{
 			continue;
 		}
-		Vector3 position;
-		Quaternion rotation;
-		if (animationResource->getSampleType() == SAMPLE_STEP)
+		m_activeTracks.push_back(binding.tracks[i]);
+		m_poseBones.push_back(boneId);
+	}
+	if (m_activeTracks.empty())
+	{
+		return;
+	}
+	if (g_poseCache->isEnabled())
+	{
+		g_poseCache->getPose(animationResource, sampleTime, &m_activeTracks[0], m_activeTracks.size(), m_pose);
+	}
+	else
+	{
+		BatchSampler::sample(*animationResource,
+							frame,
+							step ? 0.0f : factor,
+							&m_activeTracks[0],
+							m_activeTracks.size(),
+							m_pose);
+	}
+
+	//channels missing from the clip are bind pose
+	for (size_t i = 0; i < m_poseBones.size(); ++i)
+	{
+		unsigned char channels = m_pose.channels[i];
+		if ((channels & (POSE_POSITION | POSE_ROTATION | POSE_SCALE)) == (POSE_POSITION | POSE_ROTATION | POSE_SCALE))
 		{
-			StepSampler::sample(track.positionKeys, sampleTime, fps, position);
-			StepSampler::sample(track.rotationKeys, sampleTime, fps, rotation);
+			continue;
 		}
-		else
+		const CoreBone* coreBone = m_skeleton->getBone(m_poseBones[i])->getCoreBone();
+		if ((channels & POSE_POSITION) == 0)
 		{
-			LinearSampler::sample(track.positionKeys, sampleTime, fps, position);
-			LinearSampler::sample(track.rotationKeys, sampleTime, fps, rotation);
+			m_pose.positions[i] = coreBone->position;
 		}
-		if (track.scaleKeys.empty())
+		if ((channels & POSE_ROTATION) == 0)
 		{
-			bone->blendTransform(animation->getWeight(), position, rotation);
+			m_pose.rotations[i] = coreBone->rotation;
 		}
-		else
+		if ((channels & POSE_SCALE) == 0)
 		{
-			Vector3 scale;
-			if (animationResource->getSampleType() == SAMPLE_STEP)
-			{
-				StepSampler::sample(track.scaleKeys, sampleTime, fps, scale);
-			}
-			else
-			{
-				LinearSampler::sample(track.scaleKeys, sampleTime, fps, scale);
-			}
-			bone->blendTransform(animation->getWeight(), position, rotation, scale); 
+			m_pose.scales[i] = coreBone->scale;
 		}
 	}
+	m_skeleton->blendPose(m_pose, &m_poseBones[0], m_poseBones.size(), animation->getWeight());
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -927,38 +1199,58 @@ void Model::blendSplineAnimation(Animation* animation)
 		return;
 	}
 	const VECTOR(BoneTrack)& boneTracks = animation->getAnimationResource()->getBoneTracks();
-	for (size_t i = 0; i < boneTracks.size(); ++i)
+	bool bindPoseOmitted = animation->getAnimationResource()->isBindPoseOmitted();
+	const BoneBinding& binding = animation->getBoneBinding();
+	m_pose.resize(binding.tracks.size());
+	m_poseBones.clear();
+	for (size_t i = 0; i < binding.tracks.size(); ++i)
 	{
-		const BoneTrack& track = boneTracks[i];
-		int boneId = animation->getBoneId(i);
-		Bone* bone = (boneId < 0) ? NULL : m_skeleton->getBone(boneId);
-		if (bone == NULL || !bone->hasWeightLeft())	//all weight has been taken, no need to blend any more
+		const BoneTrack& track = boneTracks[binding.tracks[i]];
+		int boneId = binding.boneIds[i];
+		if (!m_skeleton->hasWeightLeft(boneId))	//all weight has been taken, no need to blend any more
 		{
 			continue;
 		}
-		if (m_skeletonLodEnabled && m_lodTolerance > bone->getLodError())
+		if (!m_skeleton->isBoneActive(boneId))	//pruned by skeleton lod
 		{
 			continue;
 		}
-		if (track.positionKeys.empty() || track.rotationKeys.empty())
+		const Bone* bone = m_skeleton->getBone(boneId);
+		if (!bindPoseOmitted
+			&& (track.positionKeys.empty() || track.rotationKeys.empty()))
 		{
 			continue;
 		}
-		Vector3 position;
-		Quaternion rotation;
-		SplineSampler::sample(track.positionKeys, track.positionKnots, sampleTime, position);
-		SplineSampler::sample(track.rotationKeys, track.rotationKnots, sampleTime, rotation);
-		rotation.normalize();
-		if (track.scaleKeys.empty())
+		size_t index = m_poseBones.size();
+		m_poseBones.push_back(boneId);
+		const CoreBone* coreBone = bone->getCoreBone();
+		Vector3& position = m_pose.positions[index];
+		Quaternion& rotation = m_pose.rotations[index];
+		Vector3& scale = m_pose.scales[index];
+		position = coreBone->position;
+		rotation = coreBone->rotation;
+		scale = coreBone->scale;
+		unsigned char channels = POSE_POSITION | POSE_ROTATION;
+		TrackCursor& cursor = animation->getTrackCursor(i);
+		if (!track.positionKeys.empty())
 		{
-			bone->blendTransform(animation->getWeight(), position, rotation);
+			SplineSampler::sample(track.positionKeys, track.positionKnots, sampleTime, cursor.position, position);
 		}
-		else
+		if (!track.rotationKeys.empty())
+		{
+			SplineSampler::sample(track.rotationKeys, track.rotationKnots, sampleTime, cursor.rotation, rotation);
+			rotation.normalize();
+		}
+		if (!track.scaleKeys.empty())
 		{
-			Vector3 scale;
-			SplineSampler::sample(track.scaleKeys, track.scaleKnots, sampleTime, scale);
-			bone->blendTransform(animation->getWeight(), position, rotation, scale); 
+			SplineSampler::sample(track.scaleKeys, track.scaleKnots, sampleTime, cursor.scale, scale);
+			channels |= POSE_SCALE;
 		}
+		m_pose.channels[index] = channels;
+	}
+	if (!m_poseBones.empty())
+	{
+		m_skeleton->blendPose(m_pose, &m_poseBones[0], m_poseBones.size(), animation->getWeight());
 	}
 }
 
@@ -1212,15 +1504,10 @@ void Model::buildAnimation(Animation* animation)
 
 	const AnimationResource* animationResource = animation->getAnimationResource();
 	assert(animationResource != NULL);
-	const VECTOR(BoneTrack)& boneTracks = animationResource->getBoneTracks();
-	VECTOR(int) boneIds(boneTracks.size());
 	const SkeletonResource* skeletonResource = m_skeleton->getSkeletonResource();
 	assert(skeletonResource != NULL);
-	for (size_t i = 0; i < boneTracks.size(); ++i)
-	{
-		boneIds[i] = skeletonResource->getBoneId(boneTracks[i].boneName);
-	}
-	animation->build(boneIds);
+	animation->build(animationResource->grabBoneBinding(*skeletonResource));
+	m_poseDirty = true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1298,6 +1585,7 @@ void Model::buildPartMesh(const Char* slot, Part* part)
 		}
 	}
 	m_skeletonErrorDirty = true;
+	m_skeletonLodDirty = true;
 
 	if (m_eventHandler != NULL)
 	{
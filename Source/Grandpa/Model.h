@@ -3,6 +3,7 @@
 
 #include "IModel.h"
 #include "ResourceInstance.h"
+#include "PoseBuffer.h"
 #include <map>
 #include <list>
 
@@ -36,6 +37,7 @@ public:
 	virtual void setFixedBoundingBox(const AaBox& box);
 	virtual void unsetFixedBoundingBox();
 	virtual const AaBox& getBoundingBox() const;
+	virtual bool predictBoundingBox(AaBox& box) const;
 
 	virtual ISkeleton* getSkeleton();
 
@@ -77,6 +79,9 @@ public:
 	virtual void enableSkeletonLod(bool enable);
 	virtual bool isSkeletonLodEnabled() const;
 
+	virtual void setUpdateInterval(unsigned int interval);
+	virtual unsigned int getUpdateInterval() const;
+
 	virtual IProperty* getProperty() const;
 
 	virtual void setUserData(void* data);
@@ -98,12 +103,16 @@ private:
 
 	void updateInternal(double time, float elapsedTime, unsigned long flag);
 	void updateAnimations(float elapsedTime);
-	void updateSkeleton();
+	void updateSkeleton(bool blend);
+	bool isPoseDue();
 	void updateParts();
 	void updateBoundingBox();
 	void updateBoundingBoxBySkeleton();
+	float getSkinRadius() const;
 	void updateAttachments(double time, float elapsedTime, unsigned long flag);
 	void updateSkeletonError();
+
+	void updateSkeletonLod();
 	
 	void blendAnimation(Animation* animation);
 	void blendSplineAnimation(Animation* animation);
@@ -204,8 +213,19 @@ private:
 	bool					m_globalSkinning;
 
 	bool					m_skeletonErrorDirty;
+	bool					m_skeletonLodDirty;		//pruned bones and skin bindings have to be rebuilt
 
 	bool					m_useFixedBoundingBox;
+
+	unsigned int			m_updateInterval;
+	unsigned int			m_updateCount;		//starts at a different value for each model to stagger evaluation
+	bool					m_poseDirty;		//evaluate pose on next update regardless of interval
+	Matrix					m_poseTransform;	//model transform when pose was evaluated
+
+	//scratch for blendAnimation and blendSplineAnimation, kept to avoid allocation every frame
+	PoseBuffer				m_pose;
+	VECTOR(int)				m_poseBones;
+	VECTOR(int)				m_activeTracks;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -271,6 +291,7 @@ inline void Model::setLodTolerance(float tolerance)
 		return;
 	}
 	m_lodTolerance = tolerance;
+	m_skeletonLodDirty = true;
 	if (m_meshLodEnabled)
 	{
 		setAllMeshLodTolerance(tolerance);
@@ -306,6 +327,7 @@ inline bool Model::isMeshLodEnabled() const
 inline void Model::enableSkeletonLod(bool enable)
 {
 	m_skeletonLodEnabled = enable;
+	m_skeletonLodDirty = true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -314,6 +336,26 @@ inline bool Model::isSkeletonLodEnabled() const
 	return m_skeletonLodEnabled;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void Model::setUpdateInterval(unsigned int interval)
+{
+	if (interval == 0)
+	{
+		interval = 1;
+	}
+	if (interval < m_updateInterval)
+	{	//don't keep an old pose for the rest of the longer interval
+		m_poseDirty = true;
+	}
+	m_updateInterval = interval;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline unsigned int Model::getUpdateInterval() const
+{
+	return m_updateInterval;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 inline void Model::setUserData(void* data)
 {
@@ -0,0 +1,189 @@
+#include "Precompiled.h"
+#include "PoseBlender.h"
+#include "Simd.h"
+#include "Performance.h"
+
+namespace grp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PoseBlender::PoseBlender()
+	: m_boneCount(0)
+	, m_laneCount(0)
+	, m_layerEmpty(true)
+{
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseBlender::resize(size_t boneCount)
+{
+	m_boneCount = boneCount;
+	m_laneCount = (boneCount + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+
+	//identity everywhere keeps padding lanes clean
+	m_layer.assign(m_laneCount * COMPONENT_COUNT, 0.0f);
+	std::fill(m_layer.begin() + (ROTATION_COMPONENT + 3) * m_laneCount,
+				m_layer.begin() + (ROTATION_COMPONENT + 4) * m_laneCount,
+				1.0f);
+	m_result = m_layer;
+	m_layerWeight.assign(m_laneCount, 0.0f);
+	m_weight.assign(m_laneCount, 0.0f);
+	m_factors.assign(m_laneCount, 0.0f);
+	m_scaleFactors.assign(m_laneCount, 0.0f);
+	m_scaled.assign(m_laneCount, 0);
+	m_layerEmpty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseBlender::reset()
+{
+	std::fill(m_layerWeight.begin(), m_layerWeight.end(), 0.0f);
+	std::fill(m_weight.begin(), m_weight.end(), 0.0f);
+	m_layerEmpty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseBlender::blend(const PoseBuffer& pose, const int* boneIds, size_t count, float weight)
+{
+	PERF_NODE_FUNC();
+
+	assert(weight > 0.0f);
+
+	//bones of a batch are gathered into lanes, blended, then scattered back
+	const size_t BATCH_SIZE = SIMD_WIDTH;
+	float layer[COMPONENT_COUNT][BATCH_SIZE];
+	float sampled[COMPONENT_COUNT][BATCH_SIZE];
+	float factors[BATCH_SIZE];
+	float scaleFactors[BATCH_SIZE];
+
+	for (size_t start = 0; start < count; start += BATCH_SIZE)
+	{
+		size_t laneCount = std::min(count - start, BATCH_SIZE);
+		for (size_t lane = 0; lane < BATCH_SIZE; ++lane)
+		{
+			if (lane >= laneCount)
+			{	//padding lanes, identity and factor 0
+				for (int c = 0; c < COMPONENT_COUNT; ++c)
+				{
+					layer[c][lane] = sampled[c][lane] = 0.0f;
+				}
+				layer[ROTATION_COMPONENT + 3][lane] = sampled[ROTATION_COMPONENT + 3][lane] = 1.0f;
+				factors[lane] = scaleFactors[lane] = 0.0f;
+				continue;
+			}
+			size_t index = start + lane;
+			int boneId = boneIds[index];
+			assert(hasWeightLeft(boneId));
+			for (int c = 0; c < COMPONENT_COUNT; ++c)
+			{
+				layer[c][lane] = getComponent(m_layer, c, boneId);
+			}
+			const Vector3& position = pose.positions[index];
+			const Quaternion& rotation = pose.rotations[index];
+			const Vector3& scale = pose.scales[index];
+			sampled[POSITION_COMPONENT][lane] = position.X;
+			sampled[POSITION_COMPONENT + 1][lane] = position.Y;
+			sampled[POSITION_COMPONENT + 2][lane] = position.Z;
+			sampled[ROTATION_COMPONENT][lane] = rotation.X;
+			sampled[ROTATION_COMPONENT + 1][lane] = rotation.Y;
+			sampled[ROTATION_COMPONENT + 2][lane] = rotation.Z;
+			sampled[ROTATION_COMPONENT + 3][lane] = rotation.W;
+			sampled[SCALE_COMPONENT][lane] = scale.X;
+			sampled[SCALE_COMPONENT + 1][lane] = scale.Y;
+			sampled[SCALE_COMPONENT + 2][lane] = scale.Z;
+
+			//first animation of the priority is copied
+			float layerWeight = m_layerWeight[boneId];
+			factors[lane] = (layerWeight == 0.0f) ? 1.0f : weight / (weight + layerWeight);
+			if ((pose.channels[index] & POSE_SCALE) != 0)
+			{
+				scaleFactors[lane] = factors[lane];
+				m_scaled[boneId] = 1;
+			}
+			else
+			{
+				//bind scale is taken only if nothing blended yet
+				scaleFactors[lane] = (layerWeight == 0.0f) ? 1.0f : 0.0f;
+			}
+			m_layerWeight[boneId] = layerWeight + weight;
+		}
+
+		lerpLanes(layer[POSITION_COMPONENT], sampled[POSITION_COMPONENT], factors, 3, BATCH_SIZE);
+		nlerpLanes(layer[ROTATION_COMPONENT], sampled[ROTATION_COMPONENT], factors, BATCH_SIZE);
+		lerpLanes(layer[SCALE_COMPONENT], sampled[SCALE_COMPONENT], scaleFactors, 3, BATCH_SIZE);
+
+		for (size_t lane = 0; lane < laneCount; ++lane)
+		{
+			int boneId = boneIds[start + lane];
+			for (int c = 0; c < COMPONENT_COUNT; ++c)
+			{
+				m_layer[c * m_laneCount + boneId] = layer[c][lane];
+			}
+		}
+	}
+	if (count > 0)
+	{
+		m_layerEmpty = false;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseBlender::lock()
+{
+	PERF_NODE_FUNC();
+
+	if (m_layerEmpty)
+	{
+		return;
+	}
+	for (size_t i = 0; i < m_boneCount; ++i)
+	{
+		float layerWeight = m_layerWeight[i];
+		float weight = m_weight[i];
+		if (layerWeight > 1.0f - weight)
+		{
+			layerWeight = 1.0f - weight;
+		}
+		float factor = 0.0f;
+		if (layerWeight > 0.0f)
+		{
+			factor = (weight == 0.0f) ? 1.0f : layerWeight / (layerWeight + weight);
+			m_weight[i] = weight + layerWeight;
+		}
+		m_factors[i] = factor;
+		m_scaleFactors[i] = m_scaled[i] ? factor : 0.0f;
+		m_layerWeight[i] = 0.0f;
+	}
+	lerpLanes(getComponent(m_result, POSITION_COMPONENT),
+				getComponent(m_layer, POSITION_COMPONENT),
+				&m_factors[0],
+				3,
+				m_laneCount);
+	nlerpLanes(getComponent(m_result, ROTATION_COMPONENT),
+				getComponent(m_layer, ROTATION_COMPONENT),
+				&m_factors[0],
+				m_laneCount);
+	lerpLanes(getComponent(m_result, SCALE_COMPONENT),
+				getComponent(m_layer, SCALE_COMPONENT),
+				&m_scaleFactors[0],
+				3,
+				m_laneCount);
+	m_layerEmpty = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseBlender::getTransform(int boneId, Vector3& position, Quaternion& rotation, Vector3& scale) const
+{
+	position.set(getComponent(m_result, POSITION_COMPONENT, boneId),
+				getComponent(m_result, POSITION_COMPONENT + 1, boneId),
+				getComponent(m_result, POSITION_COMPONENT + 2, boneId));
+	rotation.set(getComponent(m_result, ROTATION_COMPONENT, boneId),
+				getComponent(m_result, ROTATION_COMPONENT + 1, boneId),
+				getComponent(m_result, ROTATION_COMPONENT + 2, boneId),
+				getComponent(m_result, ROTATION_COMPONENT + 3, boneId));
+	scale.set(getComponent(m_result, SCALE_COMPONENT, boneId),
+				getComponent(m_result, SCALE_COMPONENT + 1, boneId),
+				getComponent(m_result, SCALE_COMPONENT + 2, boneId));
+}
+
+}
@@ -0,0 +1,107 @@
+#ifndef __GRP_POSE_BLENDER_H__
+#define __GRP_POSE_BLENDER_H__
+
+#include "PoseBuffer.h"
+
+namespace grp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//blends sampled poses of all playing animations, bone transforms are kept component major
+//so whole skeleton is merged with simd kernels when priority changes
+//
+//weights work the same as before: animations of the same priority are averaged by weight,
+//then each priority takes what's left from higher priorities, until weight of a bone reaches 1
+class PoseBlender
+{
+public:
+	PoseBlender();
+
+	void resize(size_t boneCount);
+
+	//clear weights, start of a frame
+	void reset();
+
+	bool hasWeightLeft(int boneId) const;
+
+	void setScaled(int boneId, bool scaled);
+	bool isScaled(int boneId) const;
+
+	//blend pose of one animation into current priority, entry i of pose goes to boneIds[i]
+	//position and rotation of every entry must be valid, scale only if POSE_SCALE is set
+	void blend(const PoseBuffer& pose, const int* boneIds, size_t count, float weight);
+
+	//merge current priority into result, call when priority changes and at the end
+	void lock();
+
+	float getWeight(int boneId) const;
+
+	void getTransform(int boneId, Vector3& position, Quaternion& rotation, Vector3& scale) const;
+
+private:
+	enum
+	{
+		POSITION_COMPONENT = 0,
+		ROTATION_COMPONENT = 3,
+		SCALE_COMPONENT = 7,
+		COMPONENT_COUNT = 10
+	};
+	float* getComponent(VECTOR(float)& transforms, int component);
+	float getComponent(const VECTOR(float)& transforms, int component, int boneId) const;
+
+private:
+	size_t					m_boneCount;
+	size_t					m_laneCount;	//bone count padded to simd width
+
+	VECTOR(float)			m_layer;		//current priority
+	VECTOR(float)			m_layerWeight;
+	VECTOR(float)			m_result;		//locked priorities
+	VECTOR(float)			m_weight;
+
+	VECTOR(float)			m_factors;
+	VECTOR(float)			m_scaleFactors;
+	VECTOR(unsigned char)	m_scaled;
+
+	bool					m_layerEmpty;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool PoseBlender::hasWeightLeft(int boneId) const
+{
+	assert(boneId >= 0 && static_cast<size_t>(boneId) < m_boneCount);
+	return (m_weight[boneId] < 1.0f);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void PoseBlender::setScaled(int boneId, bool scaled)
+{
+	m_scaled[boneId] = scaled ? 1 : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool PoseBlender::isScaled(int boneId) const
+{
+	return (m_scaled[boneId] != 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline float PoseBlender::getWeight(int boneId) const
+{
+	return m_weight[boneId];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline float* PoseBlender::getComponent(VECTOR(float)& transforms, int component)
+{
+	return &transforms[component * m_laneCount];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline float PoseBlender::getComponent(const VECTOR(float)& transforms, int component, int boneId) const
+{
+	return transforms[component * m_laneCount + boneId];
+}
+
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __GRP_POSE_BUFFER_H__
+#define __GRP_POSE_BUFFER_H__
+
+namespace grp
+{
+
+enum PoseChannel
+{
+	POSE_POSITION = 1,
+	POSE_ROTATION = 2,
+	POSE_SCALE = 4
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//local transforms sampled from one clip, one entry per sampled track
+//channels holds which of position/rotation/scale were written, others are left to the caller
+struct PoseBuffer
+{
+	VECTOR(Vector3)			positions;
+	VECTOR(Quaternion)		rotations;
+	VECTOR(Vector3)			scales;
+	VECTOR(unsigned char)	channels;
+
+	void resize(size_t count);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void PoseBuffer::resize(size_t count)
+{
+	//never shrink, buffers are reused every frame
+	if (count > positions.size())
+	{
+		positions.resize(count);
+		rotations.resize(count);
+		scales.resize(count);
+		channels.resize(count);
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+#include "Precompiled.h"
+#include "PoseCache.h"
+#include "ContentResource.h"
+#include "BatchSampler.h"
+#include "Performance.h"
+
+namespace grp
+{
+
+static const size_t DEFAULT_MAX_POSES = 1024;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PoseCache::PoseCache()
+	: m_subframes(0)
+	, m_maxBucketEntries(DEFAULT_MAX_POSES / BUCKET_COUNT)
+{
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		Bucket& bucket = m_buckets[i];
+		bucket.hitCount = 0;
+		bucket.missCount = 0;
+#ifdef _GRP_WIN32_THREAD_SAFE
+		::InitializeCriticalSection(&bucket.cs);
+#endif
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+PoseCache::~PoseCache()
+{
+	clear();
+#ifdef _GRP_WIN32_THREAD_SAFE
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		::DeleteCriticalSection(&m_buckets[i].cs);
+	}
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseCache::setSubframes(unsigned int subframes)
+{
+	if (subframes != m_subframes)
+	{
+		clear();
+		m_subframes = subframes;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseCache::setMaxPoses(size_t maxPoses)
+{
+	m_maxBucketEntries = std::max<size_t>(maxPoses / BUCKET_COUNT, 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseCache::getPose(const AnimationResource* clip, float time, const int* tracks, size_t count, PoseBuffer& out)
+{
+	PERF_NODE_FUNC();
+
+	assert(isEnabled());
+	assert(clip != NULL && clip->isPacked());
+	assert(tracks != NULL || count == 0);
+
+	float subframeRate = clip->getFps() * m_subframes;
+	Key key;
+	key.clip = clip;
+	key.sampleType = clip->getSampleType();
+	key.position = (time > 0.0f) ? static_cast<unsigned long>(time * subframeRate + 0.5f) : 0;
+
+	//misses are sampled inside the lock so no other thread sees a half filled pose,
+	//tracks are copied out before unlock since the entry may be dropped right after
+	Bucket& bucket = getBucket(key);
+#ifdef _GRP_WIN32_THREAD_SAFE
+	Lock lock(&bucket.cs);
+#endif
+	MAP(Key, Entry)::iterator found = bucket.entries.find(key);
+	if (found != bucket.entries.end())
+	{
+		++bucket.hitCount;
+	}
+	else
+	{
+		++bucket.missCount;
+		if (bucket.entries.size() >= m_maxBucketEntries)
+		{
+			sweep(bucket, m_maxBucketEntries);
+		}
+
+		//resource is kept alive as long as its poses are cached
+		clip->grab();
+		found = bucket.entries.insert(std::make_pair(key, Entry())).first;
+
+		size_t trackCount = clip->getPackedTracks().size();
+		for (size_t i = bucket.tracks.size(); i < trackCount; ++i)
+		{
+			bucket.tracks.push_back(static_cast<int>(i));
+		}
+		if (trackCount > 0)
+		{
+			size_t frame;
+			float factor;
+			clip->getFrame(key.position / subframeRate, frame, factor);
+			BatchSampler::sample(*clip,
+								frame,
+								(key.sampleType == SAMPLE_STEP) ? 0.0f : factor,
+								&bucket.tracks[0],
+								trackCount,
+								found->second.pose);
+		}
+	}
+	Entry& entry = found->second;
+	entry.used = true;
+
+	out.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		int track = tracks[i];
+		out.positions[i] = entry.pose.positions[track];
+		out.rotations[i] = entry.pose.rotations[track];
+		out.scales[i] = entry.pose.scales[track];
+		out.channels[i] = entry.pose.channels[track];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseCache::sweep(Bucket& bucket, size_t maxEntries)
+{
+	MAP(Key, Entry)::iterator iter = bucket.entries.begin();
+	while (iter != bucket.entries.end())
+	{
+		if (iter->second.used)
+		{
+			iter->second.used = false;
+			++iter;
+		}
+		else
+		{
+			const AnimationResource* clip = iter->first.clip;
+			bucket.entries.erase(iter++);
+			clip->drop();
+		}
+	}
+	//everything was used since last sweep, make room anyway
+	while (bucket.entries.size() >= maxEntries && !bucket.entries.empty())
+	{
+		const AnimationResource* clip = bucket.entries.begin()->first.clip;
+		bucket.entries.erase(bucket.entries.begin());
+		clip->drop();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseCache::flush()
+{
+	PERF_NODE_FUNC();
+
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		Bucket& bucket = m_buckets[i];
+#ifdef _GRP_WIN32_THREAD_SAFE
+		Lock lock(&bucket.cs);
+#endif
+		//no room needed, only unused poses go
+		sweep(bucket, static_cast<size_t>(-1));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void PoseCache::clear()
+{
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		Bucket& bucket = m_buckets[i];
+#ifdef _GRP_WIN32_THREAD_SAFE
+		Lock lock(&bucket.cs);
+#endif
+		for (MAP(Key, Entry)::iterator iter = bucket.entries.begin();
+			iter != bucket.entries.end();
+			++iter)
+		{
+			iter->first.clip->drop();
+		}
+		bucket.entries.clear();
+	}
+}
+
+}
@@ -0,0 +1,163 @@
+#ifndef __GRP_POSE_CACHE_H__
+#define __GRP_POSE_CACHE_H__
+
+#include "PoseBuffer.h"
+#include <map>
+
+namespace grp
+{
+
+class AnimationFile;
+template<class T, ResourceType resType> class ContentResource;
+typedef ContentResource<AnimationFile, RES_TYPE_ANIMATION> AnimationResource;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//sampled poses of packed clips shared by all models, so a crowd playing the same clip
+//at about the same time samples it only once.
+//sample time is quantized to 1/subframes of a clip frame, entry i of a pose is packed track i.
+//poses are spread over buckets by clip and time, each with its own lock and size limit.
+//getPose and flush may be called by models updated on several threads with _GRP_WIN32_THREAD_SAFE,
+//otherwise from one thread only. setSubframes and clear must not overlap any getPose
+class PoseCache
+{
+public:
+	PoseCache();
+	~PoseCache();
+
+	//0 disables the cache
+	void setSubframes(unsigned int subframes);
+	unsigned int getSubframes() const;
+	bool isEnabled() const;
+
+	//poses not used lately are dropped to keep at most about maxPoses
+	void setMaxPoses(size_t maxPoses);
+
+	//copies tracks of the pose at quantized time to out, entry i is tracks[i].
+	//the whole pose is sampled on miss
+	void getPose(const AnimationResource* clip, float time, const int* tracks, size_t count, PoseBuffer& out);
+
+	//drop poses which are not used since last flush, optional, trims the cache sooner than size limit
+	void flush();
+
+	void clear();
+
+	unsigned long getHitCount() const;
+	unsigned long getMissCount() const;
+	void resetCounters();
+
+private:
+	struct Key
+	{
+		const AnimationResource*	clip;
+		int							sampleType;
+		unsigned long				position;	//in subframes
+
+		bool operator < (const Key& other) const;
+	};
+	struct Entry
+	{
+		PoseBuffer	pose;
+		bool		used;
+	};
+	struct Bucket
+	{
+#ifdef _GRP_WIN32_THREAD_SAFE
+		CRITICAL_SECTION	cs;
+#endif
+		MAP(Key, Entry)		entries;
+		VECTOR(int)			tracks;	//0, 1, 2... for sampling all tracks
+		unsigned long		hitCount;
+		unsigned long		missCount;
+	};
+	enum { BUCKET_COUNT = 16 };
+
+private:
+	Bucket& getBucket(const Key& key);
+
+	//drops entries not used since last sweep, then any until there is room for one more
+	void sweep(Bucket& bucket, size_t maxEntries);
+
+private:
+#ifdef _GRP_WIN32_THREAD_SAFE
+	class Lock
+	{
+	public:
+		Lock(LPCRITICAL_SECTION cs) : m_cs(cs){::EnterCriticalSection(m_cs);}
+		~Lock()	{::LeaveCriticalSection(m_cs);}
+		LPCRITICAL_SECTION m_cs;
+	};
+#endif
+	Bucket				m_buckets[BUCKET_COUNT];
+	unsigned int		m_subframes;
+	size_t				m_maxBucketEntries;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline unsigned int PoseCache::getSubframes() const
+{
+	return m_subframes;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool PoseCache::isEnabled() const
+{
+	return (m_subframes > 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline unsigned long PoseCache::getHitCount() const
+{
+	unsigned long count = 0;
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		count += m_buckets[i].hitCount;
+	}
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline unsigned long PoseCache::getMissCount() const
+{
+	unsigned long count = 0;
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		count += m_buckets[i].missCount;
+	}
+	return count;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void PoseCache::resetCounters()
+{
+	for (size_t i = 0; i < BUCKET_COUNT; ++i)
+	{
+		m_buckets[i].hitCount = 0;
+		m_buckets[i].missCount = 0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline PoseCache::Bucket& PoseCache::getBucket(const Key& key)
+{
+	//neighbour times of one clip land in different buckets
+	size_t hash = reinterpret_cast<size_t>(key.clip) / sizeof(void*) + key.position;
+	return m_buckets[hash % BUCKET_COUNT];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool PoseCache::Key::operator < (const Key& other) const
+{
+	if (clip != other.clip)
+	{
+		return (clip < other.clip);
+	}
+	if (sampleType != other.sampleType)
+	{
+		return (sampleType < other.sampleType);
+	}
+	return (position < other.position);
+}
+
+}
+
+#endif
@@ -88,6 +88,7 @@ void GRP_DELETE(const Type* p)
 #include "IProperty.h"
 #include "IEventHandler.h"
 #include "ISpline.h"
+#include "ITaskScheduler.h"
 
 #include "ChunkFileIo.h"
 #include "ContentFile.h"
@@ -0,0 +1,411 @@
+#include "Precompiled.h"
+#include "Simd.h"
+
+#if defined (GRP_AVX2)
+	#if defined (_MSC_VER)
+		#include <intrin.h>
+		#define GRP_XSAVE_FUNCTION
+	#else
+		#include <cpuid.h>
+		#define GRP_XSAVE_FUNCTION __attribute__((target("xsave")))
+	#endif
+#endif
+
+namespace grp
+{
+
+#if defined (GRP_AVX2)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+GRP_XSAVE_FUNCTION static bool checkAvx2()
+{
+	int info[4];
+#if defined (_MSC_VER)
+	__cpuid(info, 0);
+	if (info[0] < 7)
+	{
+		return false;
+	}
+	__cpuid(info, 1);
+#else
+	unsigned int a, b, c, d;
+	if (__get_cpuid_max(0, NULL) < 7)
+	{
+		return false;
+	}
+	__cpuid(1, a, b, c, d);
+	info[2] = c;
+#endif
+	//fma, osxsave and avx. kernels are built with fma too, some cpus and vms report avx2 without it
+	if ((info[2] & (1 << 12)) == 0 || (info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+	{
+		return false;
+	}
+	//os saves ymm registers
+	if ((_xgetbv(0) & 6) != 6)
+	{
+		return false;
+	}
+#if defined (_MSC_VER)
+	__cpuidex(info, 7, 0);
+#else
+	__cpuid_count(7, 0, a, b, c, d);
+	info[1] = b;
+#endif
+	return ((info[1] & (1 << 5)) != 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool isAvx2Supported()
+{
+	static const bool supported = checkAvx2();
+	return supported;
+}
+
+#else
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool isAvx2Supported()
+{
+	return false;
+}
+#endif
+
+#if defined (GRP_AVX2)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+GRP_AVX2_FUNCTION static void lerpLanesAvx2(float* a, const float* b, const float* factors, int componentCount, size_t count)
+{
+	__m256 one = _mm256_set1_ps(1.0f);
+	for (size_t i = 0; i < count; i += 8)
+	{
+		__m256 f = _mm256_loadu_ps(factors + i);
+		__m256 copy = _mm256_cmp_ps(f, one, _CMP_EQ_OQ);
+		for (int c = 0; c < componentCount; ++c)
+		{
+			float* pa = a + c * count + i;
+			__m256 va = _mm256_loadu_ps(pa);
+			__m256 vb = _mm256_loadu_ps(b + c * count + i);
+			_mm256_storeu_ps(pa, _mm256_blendv_ps(_mm256_fmadd_ps(_mm256_sub_ps(vb, va), f, va), vb, copy));
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+GRP_AVX2_FUNCTION static void nlerpLanesAvx2(float* a, const float* b, const float* factors, size_t count)
+{
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 negative = _mm256_set1_ps(-0.0f);
+	for (size_t i = 0; i < count; i += 8)
+	{
+		float* px = a + i;
+		float* py = px + count;
+		float* pz = py + count;
+		float* pw = pz + count;
+		__m256 ax = _mm256_loadu_ps(px), ay = _mm256_loadu_ps(py), az = _mm256_loadu_ps(pz), aw = _mm256_loadu_ps(pw);
+		__m256 bx = _mm256_loadu_ps(b + i);
+		__m256 by = _mm256_loadu_ps(b + count + i);
+		__m256 bz = _mm256_loadu_ps(b + count * 2 + i);
+		__m256 bw = _mm256_loadu_ps(b + count * 3 + i);
+		__m256 f = _mm256_loadu_ps(factors + i);
+
+		//negate factor of b where dot < 0
+		__m256 dot = _mm256_mul_ps(ax, bx);
+		dot = _mm256_fmadd_ps(ay, by, dot);
+		dot = _mm256_fmadd_ps(az, bz, dot);
+		dot = _mm256_fmadd_ps(aw, bw, dot);
+		__m256 fb = _mm256_xor_ps(f, _mm256_and_ps(_mm256_cmp_ps(dot, zero, _CMP_LT_OQ), negative));
+		__m256 fa = _mm256_sub_ps(one, f);
+
+		__m256 x = _mm256_fmadd_ps(bx, fb, _mm256_mul_ps(ax, fa));
+		__m256 y = _mm256_fmadd_ps(by, fb, _mm256_mul_ps(ay, fa));
+		__m256 z = _mm256_fmadd_ps(bz, fb, _mm256_mul_ps(az, fa));
+		__m256 w = _mm256_fmadd_ps(bw, fb, _mm256_mul_ps(aw, fa));
+
+		__m256 lengthSq = _mm256_mul_ps(x, x);
+		lengthSq = _mm256_fmadd_ps(y, y, lengthSq);
+		lengthSq = _mm256_fmadd_ps(z, z, lengthSq);
+		lengthSq = _mm256_fmadd_ps(w, w, lengthSq);
+		//zero length falls back to identity like Quaternion::normalize
+		__m256 valid = _mm256_cmp_ps(lengthSq, zero, _CMP_NEQ_OQ);
+		__m256 invLength = _mm256_div_ps(one, _mm256_blendv_ps(one, _mm256_sqrt_ps(lengthSq), valid));
+		x = _mm256_and_ps(_mm256_mul_ps(x, invLength), valid);
+		y = _mm256_and_ps(_mm256_mul_ps(y, invLength), valid);
+		z = _mm256_and_ps(_mm256_mul_ps(z, invLength), valid);
+		w = _mm256_blendv_ps(one, _mm256_mul_ps(w, invLength), valid);
+
+		__m256 keep = _mm256_cmp_ps(f, zero, _CMP_EQ_OQ);
+		__m256 copy = _mm256_cmp_ps(f, one, _CMP_EQ_OQ);
+		_mm256_storeu_ps(px, _mm256_blendv_ps(_mm256_blendv_ps(x, bx, copy), ax, keep));
+		_mm256_storeu_ps(py, _mm256_blendv_ps(_mm256_blendv_ps(y, by, copy), ay, keep));
+		_mm256_storeu_ps(pz, _mm256_blendv_ps(_mm256_blendv_ps(z, bz, copy), az, keep));
+		_mm256_storeu_ps(pw, _mm256_blendv_ps(_mm256_blendv_ps(w, bw, copy), aw, keep));
+	}
+}
+#endif
+
+#if defined (GRP_SSE2)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static inline __m128 select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void lerpLanes(float* a, const float* b, const float* factors, int componentCount, size_t count)
+{
+	assert(count % SIMD_WIDTH == 0);
+#if defined (GRP_AVX2)
+	if (isAvx2Supported())
+	{
+		lerpLanesAvx2(a, b, factors, componentCount, count);
+		return;
+	}
+#endif
+#if defined (GRP_SSE2)
+	__m128 one = _mm_set1_ps(1.0f);
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128 f = _mm_loadu_ps(factors + i);
+		__m128 copy = _mm_cmpeq_ps(f, one);
+		for (int c = 0; c < componentCount; ++c)
+		{
+			float* pa = a + c * count + i;
+			__m128 va = _mm_loadu_ps(pa);
+			__m128 vb = _mm_loadu_ps(b + c * count + i);
+			_mm_storeu_ps(pa, select(copy, vb, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), f))));
+		}
+	}
+#else
+	for (int c = 0; c < componentCount; ++c)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			float& va = a[c * count + i];
+			float vb = b[c * count + i];
+			va = (factors[i] == 1.0f) ? vb : va + factors[i] * (vb - va);
+		}
+	}
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void nlerpLanes(float* a, const float* b, const float* factors, size_t count)
+{
+	assert(count % SIMD_WIDTH == 0);
+#if defined (GRP_AVX2) && !defined (QUATERNION_SLERP)
+	if (isAvx2Supported())
+	{
+		nlerpLanesAvx2(a, b, factors, count);
+		return;
+	}
+#endif
+#if defined (GRP_SSE2) && !defined (QUATERNION_SLERP)
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 negative = _mm_set1_ps(-0.0f);
+	for (size_t i = 0; i < count; i += 4)
+	{
+		float* px = a + i;
+		float* py = px + count;
+		float* pz = py + count;
+		float* pw = pz + count;
+		__m128 ax = _mm_loadu_ps(px), ay = _mm_loadu_ps(py), az = _mm_loadu_ps(pz), aw = _mm_loadu_ps(pw);
+		__m128 bx = _mm_loadu_ps(b + i);
+		__m128 by = _mm_loadu_ps(b + count + i);
+		__m128 bz = _mm_loadu_ps(b + count * 2 + i);
+		__m128 bw = _mm_loadu_ps(b + count * 3 + i);
+		__m128 f = _mm_loadu_ps(factors + i);
+
+		//negate factor of b where dot < 0
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+								_mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+		__m128 fb = _mm_xor_ps(f, _mm_and_ps(_mm_cmplt_ps(dot, zero), negative));
+		__m128 fa = _mm_sub_ps(one, f);
+
+		__m128 x = _mm_add_ps(_mm_mul_ps(ax, fa), _mm_mul_ps(bx, fb));
+		__m128 y = _mm_add_ps(_mm_mul_ps(ay, fa), _mm_mul_ps(by, fb));
+		__m128 z = _mm_add_ps(_mm_mul_ps(az, fa), _mm_mul_ps(bz, fb));
+		__m128 w = _mm_add_ps(_mm_mul_ps(aw, fa), _mm_mul_ps(bw, fb));
+
+		__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+									_mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+		//zero length falls back to identity like Quaternion::normalize
+		__m128 valid = _mm_cmpneq_ps(lengthSq, zero);
+		__m128 invLength = _mm_div_ps(one, select(valid, _mm_sqrt_ps(lengthSq), one));
+		x = _mm_and_ps(_mm_mul_ps(x, invLength), valid);
+		y = _mm_and_ps(_mm_mul_ps(y, invLength), valid);
+		z = _mm_and_ps(_mm_mul_ps(z, invLength), valid);
+		w = select(valid, _mm_mul_ps(w, invLength), one);
+
+		__m128 keep = _mm_cmpeq_ps(f, zero);
+		__m128 copy = _mm_cmpeq_ps(f, one);
+		_mm_storeu_ps(px, select(keep, ax, select(copy, bx, x)));
+		_mm_storeu_ps(py, select(keep, ay, select(copy, by, y)));
+		_mm_storeu_ps(pz, select(keep, az, select(copy, bz, z)));
+		_mm_storeu_ps(pw, select(keep, aw, select(copy, bw, w)));
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (factors[i] == 0.0f)
+		{
+			continue;
+		}
+		Quaternion qa(a[i], a[count + i], a[count * 2 + i], a[count * 3 + i]);
+		Quaternion qb(b[i], b[count + i], b[count * 2 + i], b[count * 3 + i]);
+		if (factors[i] == 1.0f)
+		{
+			qa = qb;
+		}
+		else
+		{
+			qa = qa.getLerp(qb, factors[i]);
+		}
+		a[i] = qa.X;
+		a[count + i] = qa.Y;
+		a[count * 2 + i] = qa.Z;
+		a[count * 3 + i] = qa.W;
+	}
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void composeTransforms(const Vector3* positions,
+						const Quaternion* rotations,
+						const Vector3* scales,
+						const unsigned char* scaled,
+						const int* ids,
+						size_t count,
+						Matrix* out)
+{
+	size_t i = 0;
+#if defined (GRP_SSE2)
+	//4 bones at a time, quaternions are transposed into x, y, z, w lanes
+	__m128 zero = _mm_setzero_ps();
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 two = _mm_set1_ps(2.0f);
+	const Vector3 unitScale(1.0f, 1.0f, 1.0f);
+	for (; i + 4 <= count; i += 4)
+	{
+		const int* batch = ids + i;
+		__m128 x = _mm_loadu_ps(&rotations[batch[0]].X);
+		__m128 y = _mm_loadu_ps(&rotations[batch[1]].X);
+		__m128 z = _mm_loadu_ps(&rotations[batch[2]].X);
+		__m128 w = _mm_loadu_ps(&rotations[batch[3]].X);
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+
+		__m128 xx2 = _mm_mul_ps(_mm_mul_ps(x, x), two);
+		__m128 yy2 = _mm_mul_ps(_mm_mul_ps(y, y), two);
+		__m128 zz2 = _mm_mul_ps(_mm_mul_ps(z, z), two);
+		__m128 xy2 = _mm_mul_ps(_mm_mul_ps(x, y), two);
+		__m128 zw2 = _mm_mul_ps(_mm_mul_ps(z, w), two);
+		__m128 xz2 = _mm_mul_ps(_mm_mul_ps(x, z), two);
+		__m128 yw2 = _mm_mul_ps(_mm_mul_ps(y, w), two);
+		__m128 yz2 = _mm_mul_ps(_mm_mul_ps(y, z), two);
+		__m128 xw2 = _mm_mul_ps(_mm_mul_ps(x, w), two);
+
+		float scaleLanes[3][4];
+		for (size_t k = 0; k < 4; ++k)
+		{
+			const Vector3& scale = scaled[batch[k]] ? scales[batch[k]] : unitScale;
+			scaleLanes[0][k] = scale.X;
+			scaleLanes[1][k] = scale.Y;
+			scaleLanes[2][k] = scale.Z;
+		}
+		__m128 sx = _mm_loadu_ps(scaleLanes[0]);
+		__m128 sy = _mm_loadu_ps(scaleLanes[1]);
+		__m128 sz = _mm_loadu_ps(scaleLanes[2]);
+
+		__m128 m11 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, yy2), zz2), sx);
+		__m128 m12 = _mm_mul_ps(_mm_add_ps(xy2, zw2), sy);
+		__m128 m13 = _mm_mul_ps(_mm_sub_ps(xz2, yw2), sz);
+		__m128 m14 = zero;
+		__m128 m21 = _mm_mul_ps(_mm_sub_ps(xy2, zw2), sx);
+		__m128 m22 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, xx2), zz2), sy);
+		__m128 m23 = _mm_mul_ps(_mm_add_ps(yz2, xw2), sz);
+		__m128 m24 = zero;
+		__m128 m31 = _mm_mul_ps(_mm_add_ps(xz2, yw2), sx);
+		__m128 m32 = _mm_mul_ps(_mm_sub_ps(yz2, xw2), sy);
+		__m128 m33 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, xx2), yy2), sz);
+		__m128 m34 = zero;
+
+		//back to one row per bone
+		_MM_TRANSPOSE4_PS(m11, m12, m13, m14);
+		_MM_TRANSPOSE4_PS(m21, m22, m23, m24);
+		_MM_TRANSPOSE4_PS(m31, m32, m33, m34);
+		__m128 rows[3][4] = { { m11, m12, m13, m14 }, { m21, m22, m23, m24 }, { m31, m32, m33, m34 } };
+		for (size_t k = 0; k < 4; ++k)
+		{
+			Matrix& transform = out[batch[k]];
+			_mm_storeu_ps(transform.M[0], rows[0][k]);
+			_mm_storeu_ps(transform.M[1], rows[1][k]);
+			_mm_storeu_ps(transform.M[2], rows[2][k]);
+			const Vector3& position = positions[batch[k]];
+			transform._41 = position.X;
+			transform._42 = position.Y;
+			transform._43 = position.Z;
+			transform._44 = 1.0f;
+		}
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		int id = ids[i];
+		if (scaled[id])
+		{
+			out[id].setTransform(positions[id], rotations[id], scales[id]);
+		}
+		else
+		{
+			out[id].setTranslationRotation(positions[id], rotations[id]);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void concatenateTransforms(const Matrix* locals,
+							const int* parentIds,
+							const int* order,
+							size_t count,
+							const Matrix& root,
+							Matrix* out)
+{
+#if defined (GRP_SSE2)
+	//rows of parent are scaled by elements of local and summed, w is fixed afterwards
+	__m128 xyzMask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	__m128 w1 = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+	for (size_t i = 0; i < count; ++i)
+	{
+		int id = order[i];
+		int parentId = parentIds[id];
+		const Matrix& parent = (parentId < 0) ? root : out[parentId];
+		const Matrix& local = locals[id];
+		Matrix& transform = out[id];
+		__m128 p1 = _mm_loadu_ps(parent.M[0]);
+		__m128 p2 = _mm_loadu_ps(parent.M[1]);
+		__m128 p3 = _mm_loadu_ps(parent.M[2]);
+		__m128 p4 = _mm_loadu_ps(parent.M[3]);
+		for (int row = 0; row < 3; ++row)
+		{
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(local.M[row][0]), p1),
+											_mm_mul_ps(_mm_set1_ps(local.M[row][1]), p2)),
+									_mm_mul_ps(_mm_set1_ps(local.M[row][2]), p3));
+			_mm_storeu_ps(transform.M[row], _mm_and_ps(r, xyzMask));
+		}
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(local._41), p1),
+													_mm_mul_ps(_mm_set1_ps(local._42), p2)),
+											_mm_mul_ps(_mm_set1_ps(local._43), p3)),
+								p4);
+		_mm_storeu_ps(transform.M[3], _mm_or_ps(_mm_and_ps(r, xyzMask), w1));
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+	{
+		int id = order[i];
+		int parentId = parentIds[id];
+		locals[id].multiply_optimized((parentId < 0) ? root : out[parentId], out[id]);
+	}
+#endif
+}
+
+}
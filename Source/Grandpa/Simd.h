@@ -0,0 +1,55 @@
+#ifndef __GRP_SIMD_H__
+#define __GRP_SIMD_H__
+
+#if defined (GRANDPA_SIMD) && (defined (_M_IX86) || defined (_M_X64) || defined (__SSE2__))
+	#define GRP_SSE2
+	#include <emmintrin.h>
+	#if defined (GRANDPA_AVX2)
+		#define GRP_AVX2
+		#include <immintrin.h>
+		#if defined (__GNUC__)
+			#define GRP_AVX2_FUNCTION __attribute__((target("avx2,fma")))
+		#else
+			#define GRP_AVX2_FUNCTION
+		#endif
+	#endif
+#endif
+
+namespace grp
+{
+
+//lane arrays passed to the kernels are padded to a multiple of this
+const size_t SIMD_WIDTH = 8;
+
+//avx2 and fma support of cpu and os, checked once
+bool isAvx2Supported();
+
+//component major lanes, component c of lane i at [c * count + i], count is a multiple of SIMD_WIDTH
+//factor 0 keeps a, factor 1 copies b, results are written to a
+void lerpLanes(float* a, const float* b, const float* factors, int componentCount, size_t count);
+
+//quaternion interpolation taking the shortest path, same as Quaternion::getLerp
+void nlerpLanes(float* a, const float* b, const float* factors, size_t count);
+
+//local matrices of bones listed in ids like Matrix::setTransform,
+//scale is applied only where scaled[id] != 0
+void composeTransforms(const Vector3* positions,
+						const Quaternion* rotations,
+						const Vector3* scales,
+						const unsigned char* scaled,
+						const int* ids,
+						size_t count,
+						Matrix* out);
+
+//out[i] = locals[i] * out[parent of i] (root if no parent) like Matrix::multiply_optimized,
+//bones listed in order are visited, parents have to come before their children
+void concatenateTransforms(const Matrix* locals,
+							const int* parentIds,
+							const int* order,
+							size_t count,
+							const Matrix& root,
+							Matrix* out);
+
+}
+
+#endif
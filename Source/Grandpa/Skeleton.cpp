@@ -4,10 +4,14 @@
 #include "ContentResource.h"
 #include "IkSolver.h"
 #include "Performance.h"
+#include "Simd.h"
 
 namespace grp
 {
 
+extern ITaskScheduler* g_taskScheduler;
+extern size_t g_parallelBoneCount;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 const Char* Bone::getName() const
 {
@@ -20,71 +24,31 @@ const Char* Bone::getProperty() const
 	return m_core->property.c_str();
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////
-void Bone::lockTransform()
-{
-	if (m_totalWeightTemp > 1.0f - m_totalWeight)
-	{
-		m_totalWeightTemp = 1.0f - m_totalWeight;
-	}
-	if (m_totalWeightTemp <= 0.0f)
-	{
-		return;
-	}
-	if (m_totalWeight == 0.0f)
-	{
-		m_position = m_positionTemp;
-		m_rotation = m_rotationTemp;
-		if (BONE_TYPE_SCALE == m_type)
-		{
-			m_scale = m_scaleTemp;
-		}
-		m_totalWeight = m_totalWeightTemp;
-	}
-	else
-	{
-		float factor = m_totalWeightTemp / (m_totalWeightTemp + m_totalWeight);
-		m_position.lerp(m_positionTemp, factor);
-	#ifdef QUATERNION_SLERP
-		m_rotation.slerp(m_rotationTemp, factor);
-	#else
-		m_rotation.nlerp(m_rotationTemp, factor);
-	#endif
-		if (BONE_TYPE_SCALE == m_type)
-		{
-			m_scale.lerp(m_scaleTemp, factor);
-		}
-		m_totalWeight += m_totalWeightTemp;
-	}
-    m_totalWeightTemp = 0.0f;
-}
-
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Bone::update()
 {
+	assert(m_skeleton != NULL);
+	Skeleton& skeleton = *m_skeleton;
 	Matrix transform;
-	if (BONE_TYPE_SCALE == m_type)
+	if (BONE_TYPE_SCALE == skeleton.m_boneTypes[m_id])
 	{
-		transform.setTransform(m_position, m_rotation, m_scale);
+		transform.setTransform(skeleton.m_positions[m_id], skeleton.m_rotations[m_id], skeleton.m_scales[m_id]);
 	}
 	else
 	{
-		transform.setTranslationRotation(m_position, m_rotation);
+		transform.setTranslationRotation(skeleton.m_positions[m_id], skeleton.m_rotations[m_id]);
 	}
 
-	assert(m_core != NULL);
-	int parentId = m_core->parentId;
+	int parentId = skeleton.m_parentIds[m_id];
 	if (parentId < 0)
 	{
-		assert(m_skeleton != NULL);
-		transform.multiply_optimized(m_skeleton->getTransform(), m_transform);
+		transform.multiply_optimized(skeleton.getTransform(), skeleton.m_transforms[m_id]);
 	}
 	else
 	{
-		Bone *parent = m_skeleton->getBone(parentId);
-		assert(parent != NULL);
-		transform.multiply_optimized(parent->getAbsoluteTransform(), m_transform);
+		transform.multiply_optimized(skeleton.m_transforms[parentId], skeleton.m_transforms[m_id]);
 	}
+	skeleton.markChanged(m_id);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -129,9 +93,10 @@ IBone* Bone::getChildById(size_t id)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Bone::updateLodError(float error)
 {
-	if (error > m_lodError)
+	float& lodError = m_skeleton->m_lodErrors[m_id];
+	if (error > lodError)
 	{
-		m_lodError = error;
+		lodError = error;
 	}
 	else if (error > 0.0f)
 	{
@@ -140,7 +105,7 @@ void Bone::updateLodError(float error)
 	Bone* parent = static_cast<Bone*>(getParent());
 	if (parent != NULL)
 	{
-		parent->updateLodError(error + m_position.length());
+		parent->updateLodError(error + getPosition().length());
 	}
 }
 
@@ -151,8 +116,13 @@ void Bone::updateLodError(float error)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 Skeleton::Skeleton(const SkeletonResource* resource)
 	: m_resource(resource)
+	, m_changedCount(0)
+	, m_transformDirty(true)
+	, m_taskGrain(0)
 	, m_callback(NULL)
+	, m_ikChanged(false)
 {
+	m_hierarchyTask.skeleton = this;
 	assert(resource != NULL);
 	resource->grab();
 }
@@ -169,63 +139,133 @@ IIkSolver* Skeleton::addIkSolver(IBone* sourceBone,
 								 const IkBoneData* data,
 								 size_t boneCount,
 								 float threshold,
-								 bool keepSourceRotation)
+								 bool keepSourceRotation,
+								 IkSolverType type)
 {
-	m_ikSolvers.push_back(IkSolver(sourceBone, data, boneCount, threshold, keepSourceRotation));
+	m_ikSolvers.push_back(IkSolver(sourceBone, data, boneCount, threshold, keepSourceRotation, type));
+	m_ikChanged = true;
 	return &(m_ikSolvers.back());
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Skeleton::reset()
+void Skeleton::pinIkBones()
 {
-	PERF_NODE_FUNC();
-
-	for (VECTOR(Bone)::iterator iter = m_bones.begin();
-		  iter != m_bones.end();
-		  ++iter)
+	for (LIST(IkSolver)::iterator iter = m_ikSolvers.begin();
+		iter != m_ikSolvers.end();
+		++iter)
 	{
-		Bone& bone = *iter;
-		bone.reset();
+		iter->pinBones();
 	}
+	m_ikChanged = false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Skeleton::resetWithScaleType()
+void Skeleton::resetLodError()
+{
+	std::fill(m_lodErrors.begin(), m_lodErrors.end(), 0.0f);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool Skeleton::setLodTolerance(float tolerance)
 {
 	PERF_NODE_FUNC();
 
-	for (VECTOR(Bone)::iterator iter = m_bones.begin();
-		  iter != m_bones.end();
-		  ++iter)
+	assert(isBuilt());
+	const VECTOR(int)& order = m_resource->getUpdateOrder();
+	//roots always stay, a bone is pruned as soon as its parent is
+	bool changed = false;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		int id = order[i];
+		int parentId = m_parentIds[id];
+		unsigned char active = (parentId < 0 || (m_active[parentId] != 0 && !(tolerance > m_lodErrors[id]))) ? 1 : 0;
+		if (active != m_active[id])
+		{
+			m_active[id] = active;
+			changed = true;
+		}
+	}
+	if (!changed)
+	{
+		return false;
+	}
+
+	const VECTOR(CoreBone)& coreBones = m_resource->getCoreBones();
+	m_lodOrder.clear();
+	m_prunedOrder.clear();
+	for (size_t i = 0; i < order.size(); ++i)
 	{
-		Bone& bone = *iter;
-		bone.resetWithScaleType();
+		int id = order[i];
+		if (m_active[id] != 0)
+		{
+			m_lodParents[id] = id;
+			m_collapseTransforms[id] = Matrix::IDENTITY;
+			m_lodOrder.push_back(id);
+			//bones coming back have been frozen for a while
+			m_dirty[id] = 1;
+			continue;
+		}
+		int parentId = m_parentIds[id];
+		const CoreBone& coreBone = coreBones[id];
+		Matrix bindTransform;
+		bindTransform.setTransform(coreBone.position, coreBone.rotation, coreBone.scale);
+		m_lodParents[id] = m_lodParents[parentId];
+		bindTransform.multiply_optimized(m_collapseTransforms[parentId], m_collapseTransforms[id]);
+		m_prunedOrder.push_back(id);
+		if (m_changed[id] != 0)
+		{
+			m_changed[id] = 0;
+			--m_changedCount;
+		}
 	}
+	//collapse transforms changed, lod parents may not move next update
+	updatePruned(true);
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Skeleton::resetLodError()
+void Skeleton::resetBlend()
 {
-	for (VECTOR(Bone)::iterator iter = m_bones.begin();
-		  iter != m_bones.end();
-		  ++iter)
+	PERF_NODE_FUNC();
+
+	m_blender.reset();
+	for (size_t i = 0; i < m_bones.size(); ++i)
 	{
-		Bone& bone = *iter;
-		bone.m_lodError = 0.0f;
+		m_blender.setScaled(static_cast<int>(i), m_boneTypes[i] == Bone::BONE_TYPE_SCALE);
 	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void Skeleton::lockTransform()
+void Skeleton::applyBlend()
 {
 	PERF_NODE_FUNC();
 
-	for (VECTOR(Bone)::iterator iter = m_bones.begin();
-		  iter != m_bones.end();
-		  ++iter)
+	m_blender.lock();
+	for (size_t i = 0; i < m_bones.size(); ++i)
 	{
-		Bone& bone = *iter;
-		bone.lockTransform();
+		int boneId = static_cast<int>(i);
+		if (m_blender.getWeight(boneId) <= 0.0f)
+		{	//not animated, keep last transform
+			continue;
+		}
+		Vector3 position;
+		Quaternion rotation;
+		Vector3 scale;
+		m_blender.getTransform(boneId, position, rotation, scale);
+		//a held pose leaves the bone clean
+		if (position != m_positions[i] || rotation != m_rotations[i])
+		{
+			m_positions[i] = position;
+			m_rotations[i] = rotation;
+			m_dirty[i] = 1;
+		}
+		if (m_blender.isScaled(boneId)
+			&& (scale != m_scales[i] || m_boneTypes[i] != Bone::BONE_TYPE_SCALE))
+		{
+			m_scales[i] = scale;
+			m_boneTypes[i] = Bone::BONE_TYPE_SCALE;
+			m_dirty[i] = 1;
+		}
 	}
 }
 
@@ -241,13 +281,10 @@ void Skeleton::update()
 		m_callback->onPreUpdate(this);
 	}
 
-	//update bones
-	for (VECTOR(Bone)::iterator iter = m_bones.begin();
-		  iter != m_bones.end();
-		  ++iter)
-	{
-		(*iter).update();
-	}
+	std::fill(m_changed.begin(), m_changed.end(), 0);
+	m_changedCount = 0;
+
+	updateHierarchy();
 
 	if (m_callback != NULL)
 	{
@@ -262,28 +299,211 @@ void Skeleton::update()
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Skeleton::updateHierarchy()
+{
+	//collect dirty bones and everything below them, parents stay ahead of children
+	const VECTOR(int)& order = m_lodOrder;
+	m_updateIds.clear();
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		int id = order[i];
+		int parentId = m_parentIds[id];
+		bool dirty = m_dirty[id] != 0 || (parentId < 0 ? m_transformDirty : m_passChanged[parentId] != 0);
+		m_passChanged[id] = dirty ? 1 : 0;
+		m_dirty[id] = 0;
+		if (dirty)
+		{
+			m_updateIds.push_back(id);
+			markChanged(id);
+		}
+	}
+	m_transformDirty = false;
+
+	//update bones
+	if (g_taskScheduler != NULL && m_updateIds.size() >= g_parallelBoneCount && !m_updateIds.empty())
+	{
+		updateParallel();
+	}
+	else if (!m_updateIds.empty())
+	{
+		composeTransforms(&m_positions[0], &m_rotations[0], &m_scales[0], &m_boneTypes[0],
+						&m_updateIds[0], m_updateIds.size(), &m_localTransforms[0]);
+		concatenateTransforms(&m_localTransforms[0], &m_parentIds[0],
+							&m_updateIds[0], m_updateIds.size(), m_transform, &m_transforms[0]);
+	}
+	updatePruned(false);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Skeleton::updatePruned(bool all)
+{
+	for (size_t i = 0; i < m_prunedOrder.size(); ++i)
+	{
+		int id = m_prunedOrder[i];
+		int lodParent = m_lodParents[id];
+		if (all || m_passChanged[lodParent] != 0)
+		{
+			m_collapseTransforms[id].multiply_optimized(m_transforms[lodParent], m_transforms[id]);
+		}
+	}
+}
+
 void Skeleton::build()
 {
 	assert(m_resource != NULL);
 	const VECTOR(CoreBone)& coreBones = m_resource->getCoreBones();
-	m_bones.resize(coreBones.size());
-	for (size_t i = 0; i < coreBones.size(); ++i)
+	size_t boneCount = coreBones.size();
+	m_bones.resize(boneCount);
+	m_positions.resize(boneCount);
+	m_rotations.resize(boneCount);
+	m_scales.resize(boneCount);
+	m_localTransforms.resize(boneCount);
+	m_transforms.resize(boneCount);
+	m_parentIds.resize(boneCount);
+	m_boneTypes.resize(boneCount);
+	m_lodErrors.resize(boneCount, 0.0f);
+	m_dirty.resize(boneCount, 1);
+	m_changed.resize(boneCount, 0);
+	m_passChanged.resize(boneCount, 0);
+	m_updateIds.reserve(boneCount);
+	m_active.resize(boneCount, 1);
+	m_lodParents.resize(boneCount);
+	m_collapseTransforms.resize(boneCount, Matrix::IDENTITY);
+	m_lodOrder = m_resource->getUpdateOrder();
+	assert(m_lodOrder.size() == boneCount);
+	m_subtreeSizes.resize(boneCount, 1);
+	m_taskIds.resize(boneCount);
+	for (size_t i = 0; i < boneCount; ++i)
 	{
+		const CoreBone& coreBone = coreBones[i];
 		Bone& bone = m_bones[i];
-		bone.m_core = &(coreBones[i]);
+		bone.m_core = &coreBone;
 		bone.m_skeleton = this;
-		bone.m_position = bone.m_core->position;
-		bone.m_rotation = bone.m_core->rotation;
-		bone.m_scale = bone.m_core->scale;
-		if (bone.m_scale != Vector3(1.0f, 1.0f, 1.0f))
+		bone.m_id = static_cast<int>(i);
+		m_positions[i] = coreBone.position;
+		m_rotations[i] = coreBone.rotation;
+		m_scales[i] = coreBone.scale;
+		m_parentIds[i] = coreBone.parentId;
+		m_lodParents[i] = static_cast<int>(i);
+		m_boneTypes[i] = (coreBone.scale != Vector3(1.0f, 1.0f, 1.0f))
+						? Bone::BONE_TYPE_SCALE : Bone::BONE_TYPE_NO_SCALE;
+	}
+	//children come after parents, so sizes are complete when added to parent
+	for (size_t i = boneCount; i-- > 0; )
+	{
+		int id = m_lodOrder[i];
+		if (m_parentIds[id] >= 0)
 		{
-			bone.m_fileType = Bone::BONE_TYPE_SCALE;
+			m_subtreeSizes[m_parentIds[id]] += m_subtreeSizes[id];
 		}
 	}
-	resetWithScaleType();
+	m_blender.resize(m_bones.size());
 	setBuilt();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Skeleton::updateParallel()
+{
+	PERF_NODE_FUNC();
+
+	assert(g_taskScheduler != NULL);
+	size_t grain = std::max<size_t>(m_bones.size() / (g_taskScheduler->getWorkerCount() * 4 + 1), 16);
+	if (grain != m_taskGrain)
+	{
+		buildTasks(grain);
+	}
+
+	//trunk goes first, every subtree hangs below it
+	m_updateIds.clear();
+	for (size_t i = 0; i < m_trunk.size(); ++i)
+	{
+		int id = m_trunk[i];
+		if (m_active[id] != 0 && m_passChanged[id] != 0)
+		{
+			m_updateIds.push_back(id);
+		}
+	}
+	if (!m_updateIds.empty())
+	{
+		composeTransforms(&m_positions[0], &m_rotations[0], &m_scales[0], &m_boneTypes[0],
+						&m_updateIds[0], m_updateIds.size(), &m_localTransforms[0]);
+		concatenateTransforms(&m_localTransforms[0], &m_parentIds[0],
+							&m_updateIds[0], m_updateIds.size(), m_transform, &m_transforms[0]);
+	}
+	if (!m_tasks.empty())
+	{
+		g_taskScheduler->run(&m_hierarchyTask, m_tasks.size());
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Skeleton::buildTasks(size_t grain)
+{
+	const VECTOR(int)& order = m_resource->getUpdateOrder();
+	m_trunk.clear();
+	m_tasks.clear();
+	size_t position = 0;
+	while (position < order.size())
+	{
+		int id = order[position];
+		size_t size = m_subtreeSizes[id];
+		if (size > grain)
+		{	//too big, split into children
+			m_trunk.push_back(id);
+			++position;
+			continue;
+		}
+		//subtree is contiguous in update order, neighbours can share a task if no trunk bone is between
+		if (!m_tasks.empty()
+			&& m_tasks.back().end == position
+			&& m_tasks.back().end - m_tasks.back().begin + size <= grain)
+		{
+			m_tasks.back().end += size;
+		}
+		else
+		{
+			TaskRange range;
+			range.begin = position;
+			range.end = position + size;
+			m_tasks.push_back(range);
+		}
+		position += size;
+	}
+	m_taskGrain = grain;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Skeleton::updateTask(size_t index)
+{
+	assert(index < m_tasks.size());
+	const TaskRange& range = m_tasks[index];
+	const VECTOR(int)& order = m_resource->getUpdateOrder();
+	int* ids = &m_taskIds[range.begin];
+	size_t count = 0;
+	for (size_t i = range.begin; i < range.end; ++i)
+	{
+		int id = order[i];
+		if (m_active[id] != 0 && m_passChanged[id] != 0)
+		{
+			ids[count++] = id;
+		}
+	}
+	if (count > 0)
+	{
+		composeTransforms(&m_positions[0], &m_rotations[0], &m_scales[0], &m_boneTypes[0],
+						ids, count, &m_localTransforms[0]);
+		concatenateTransforms(&m_localTransforms[0], &m_parentIds[0],
+							ids, count, m_transform, &m_transforms[0]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void Skeleton::HierarchyTask::execute(size_t index)
+{
+	skeleton->updateTask(index);
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 int Skeleton::getBoneId(const STRING& name)
 {
@@ -294,11 +514,30 @@ int Skeleton::getBoneId(const STRING& name)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void Skeleton::ikUpdate()
 {
+	PERF_NODE_FUNC();
+
+	//solvers only touch their chains, the rest of the hierarchy is refreshed once for all of them
+	bool solved = false;
+	for (LIST(IkSolver)::iterator iter = m_ikSolvers.begin();
+		iter != m_ikSolvers.end();
+		++iter)
+	{
+		if ((*iter).update())
+		{
+			solved = true;
+		}
+	}
+	if (!solved)
+	{
+		return;
+	}
+	updateHierarchy();
+
 	for (LIST(IkSolver)::iterator iter = m_ikSolvers.begin();
 		iter != m_ikSolvers.end();
 		++iter)
 	{
-		(*iter).update();
+		(*iter).restoreSourceRotation();
 	}
 }
 
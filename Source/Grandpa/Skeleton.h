@@ -4,6 +4,7 @@
 #include "ISkeleton.h"
 #include "ResourceInstance.h"
 #include "IResource.h"
+#include "PoseBlender.h"
 #include <vector>
 #include <string>
 
@@ -58,16 +59,6 @@ public:
 
 	const CoreBone* getCoreBone() const;
 
-	void blendTransform(float weight,
-						const Vector3& position,
-						const Quaternion& rotation);
-	void blendTransform(float weight,
-						const Vector3& position,
-						const Quaternion& rotation,
-						const Vector3& scale);
-
-	bool hasWeightLeft() const;
-
 	void update();
 
 	float getLodError() const;
@@ -75,37 +66,17 @@ public:
 	void updateLodError(float error);
 
 private:
-	void reset();
-	void resetWithScaleType();
-
-	void lockTransform();
-	
-private:
+	//bone data lives in skeleton's arrays, bone is only a view of its slot
 	const CoreBone*		m_core;
 	Skeleton*			m_skeleton;
-
-	Vector3				m_position;
-	Quaternion			m_rotation;
-	Vector3				m_scale;
-
-	Vector3				m_positionTemp;
-	Quaternion			m_rotationTemp;
-	Vector3				m_scaleTemp;
-
-	Matrix				m_transform;
-
-	float				m_totalWeight;
-	float				m_totalWeightTemp;
-
-	unsigned short		m_fileType;
-	unsigned short		m_type;
-
-	float				m_lodError;	//depends on attached skin, so it's not in core bone
+	int					m_id;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 class Skeleton : public ISkeleton, public ResourceInstance
 {
+	friend class Bone;
+
 public:
 	Skeleton(const SkeletonResource* resource);
 	~Skeleton();
@@ -121,27 +92,60 @@ public:
 
 	virtual void removeCallback();
 
+	virtual bool isBoneChanged(size_t id) const;
+
+	virtual size_t getChangedBoneCount() const;
+
 	virtual IIkSolver* addIkSolver(IBone* sourceBone,
 									const IkBoneData* data,
 									size_t boneCount,
 									float threshold,
-									bool keepSourceRotation = true);
+									bool keepSourceRotation = true,
+									IkSolverType type = IK_SOLVER_AUTO);
 
 	const SkeletonResource* getSkeletonResource() const;
 
 	const VECTOR(Bone)& getBones() const;
 
-	void reset();
-	void resetWithScaleType();
-
 	void resetLodError();
 
-	void lockTransform();
+	//bones with lod error below tolerance are pruned with their subtree, they are neither sampled
+	//nor evaluated, they and skins follow the nearest active ancestor in bind pose.
+	//returns false if set of active bones didn't change
+	bool setLodTolerance(float tolerance);
+
+	bool isBoneActive(int boneId) const;
+
+	//nearest active bone at or above boneId
+	int getLodParent(int boneId) const;
+
+	//bind pose of bone relative to its lod parent, identity for active bones
+	const Matrix& getCollapseTransform(int boneId) const;
+
+	//keeps source and chain bones of every ik solver from being pruned
+	void pinIkBones();
+
+	//ik solver added since last pinIkBones
+	bool isIkChanged() const;
+
+	//blend pipeline: resetBlend, blendPose of each animation, lockBlend when priority changes,
+	//applyBlend writes the result into bones
+	void resetBlend();
+
+	bool hasWeightLeft(int boneId) const;
+
+	void blendPose(const PoseBuffer& pose, const int* boneIds, size_t count, float weight);
+
+	void lockBlend();
+
+	void applyBlend();
 
 	int getBoneId(const STRING& name);
 
 	Bone* getBone(int id);
 
+	//only bones marked dirty and their descendants are evaluated,
+	//local transforms first, then concatenated in parent first order
 	void update();
 
 	void setTransform(const Matrix& transform);
@@ -150,24 +154,79 @@ public:
 	void build();
 
 private:
+	//evaluates dirty bones and their descendants
+	void updateHierarchy();
+
 	void ikUpdate();
 
+	void markChanged(int id);
+
+	//parallel hierarchy update, see setTaskScheduler
+	void updateParallel();
+
+	//splits update order into a serial trunk and subtrees of at most grain bones
+	void buildTasks(size_t grain);
+
+	void updateTask(size_t index);
+
+	//pruned bones follow their lod parent in bind pose
+	void updatePruned(bool all);
+
+private:
+	struct HierarchyTask : public ITask
+	{
+		virtual void execute(size_t index);
+		Skeleton* skeleton;
+	};
+
+	//range of positions in update order
+	struct TaskRange
+	{
+		size_t begin;
+		size_t end;
+	};
+
 private:
 	const SkeletonResource*		m_resource;
 	VECTOR(Bone)				m_bones;
+	//indexed by bone id, sized once in build() so transform addresses are stable
+	VECTOR(Vector3)				m_positions;
+	VECTOR(Quaternion)			m_rotations;
+	VECTOR(Vector3)				m_scales;
+	VECTOR(Matrix)				m_localTransforms;
+	VECTOR(Matrix)				m_transforms;
+	VECTOR(int)					m_parentIds;
+	VECTOR(unsigned char)		m_boneTypes;
+	VECTOR(float)				m_lodErrors;	//depends on attached skin, so it's not in core bone
+	VECTOR(unsigned char)		m_dirty;		//local values changed since last update
+	VECTOR(unsigned char)		m_changed;		//absolute transform changed since last update began
+	VECTOR(unsigned char)		m_passChanged;	//evaluated by current updateHierarchy
+	size_t						m_changedCount;
+	VECTOR(int)					m_updateIds;
+	bool						m_transformDirty;
+	VECTOR(unsigned char)		m_active;
+	VECTOR(int)					m_lodParents;
+	VECTOR(Matrix)				m_collapseTransforms;
+	VECTOR(int)					m_lodOrder;		//update order of active bones
+	VECTOR(int)					m_prunedOrder;	//update order of pruned bones
+	VECTOR(int)					m_subtreeSizes;
+	VECTOR(int)					m_trunk;
+	VECTOR(TaskRange)			m_tasks;
+	VECTOR(int)					m_taskIds;		//each task gathers its bones at the positions of its range
+	size_t						m_taskGrain;
+	HierarchyTask				m_hierarchyTask;
 	Matrix						m_transform;
 	ISkeletonCallback*			m_callback;
 	LIST(IkSolver)				m_ikSolvers;
+	bool						m_ikChanged;
+	PoseBlender					m_blender;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline Bone::Bone()
 	: m_core(NULL)
 	, m_skeleton(NULL)
-	, m_fileType(BONE_TYPE_NO_SCALE)
-	, m_type(BONE_TYPE_NO_SCALE)
-	, m_totalWeight(0.0f)
-	, m_totalWeightTemp(0.0f)
+	, m_id(-1)
 {
 }
 
@@ -177,156 +236,87 @@ inline const CoreBone* Bone::getCoreBone() const
 	return m_core;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-inline void Bone::blendTransform(float weight,
-								   const Vector3& position,
-								   const Quaternion& rotation)
-{
-	assert (m_totalWeight < 1.0f && weight > 0.0f);
-
-	if (m_totalWeightTemp == 0.0f)
-	{
-		m_positionTemp = position;
-		m_rotationTemp = rotation;
-		m_scaleTemp = m_core->scale;
-		m_totalWeightTemp = weight;
-	}
-	else
-	{
-		float factor = weight / (weight + m_totalWeightTemp);
-		m_positionTemp.lerp(position, factor);
-	#ifdef QUATERNION_SLERP
-		m_rotationTemp.slerp(rotation, factor);
-	#else
-		m_rotationTemp.nlerp(rotation, factor);
-	#endif
-		if (BONE_TYPE_SCALE == m_type)
-		{
-			//can't do this b/c default scale can be non-unit
-			//m_scaleTemp.lerp(Vector3::UNIT_SCALE, factor);
-		}
-		m_totalWeightTemp += weight;
-	}
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////////
-inline void Bone::blendTransform(float weight,
-								   const Vector3& position,
-								   const Quaternion& rotation,
-								   const Vector3& scale)
-{
-	assert (m_totalWeight < 1.0f && weight > 0.0f);
-
-	if (m_totalWeightTemp == 0.0f)
-	{
-		m_positionTemp = position;
-		m_rotationTemp = rotation;
-		m_scaleTemp = scale;
-		m_totalWeightTemp = weight;
-	}
-	else
-	{
-		float factor = weight / (weight + m_totalWeightTemp);
-		m_positionTemp.lerp(position, factor);
-	#ifdef QUATERNION_SLERP
-		m_rotationTemp.slerp(rotation, factor);
-	#else
-		m_rotationTemp.nlerp(rotation, factor);
-	#endif
-		m_scaleTemp.lerp(scale, factor);
-		m_totalWeightTemp += weight;
-	}
-	m_type = BONE_TYPE_SCALE;
-}
-
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline void Bone::setPosition(const Vector3& position, float weight)
 {
+	Vector3& current = m_skeleton->m_positions[m_id];
 	if (weight == 1.0f)
 	{
-		m_position = position;
+		current = position;
 	}
 	else
 	{
-		m_position.lerp(position, weight);
+		current.lerp(position, weight);
 	}
+	m_skeleton->m_dirty[m_id] = 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline void Bone::setRotation(const Quaternion& rotation, float weight)
 {
+	Quaternion& current = m_skeleton->m_rotations[m_id];
 	if (weight == 1.0f)
 	{
-		m_rotation = rotation;
+		current = rotation;
 	}
 	else
 	{
 	#ifdef QUATERNION_SLERP
-		m_rotation.slerp(rotation, weight);
+		current.slerp(rotation, weight);
 	#else
-		m_rotation.nlerp(rotation, weight);
+		current.nlerp(rotation, weight);
 	#endif
 	}
+	m_skeleton->m_dirty[m_id] = 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline void Bone::setScale(const Vector3& scale, float weight)
 {
+	Vector3& current = m_skeleton->m_scales[m_id];
 	if (weight == 1.0f)
 	{
-		m_scale = scale;
+		current = scale;
 	}
 	else
 	{
-		m_scale.lerp(scale, weight);
+		current.lerp(scale, weight);
 	}
-	m_type = BONE_TYPE_SCALE;
+	m_skeleton->m_boneTypes[m_id] = BONE_TYPE_SCALE;
+	m_skeleton->m_dirty[m_id] = 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline const Vector3& Bone::getPosition() const
 {
-	return m_position;
+	return m_skeleton->m_positions[m_id];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline const Quaternion& Bone::getRotation() const
 {
-	return m_rotation;
+	return m_skeleton->m_rotations[m_id];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline const Vector3& Bone::getScale() const
 {
-	return m_scale;
+	return m_skeleton->m_scales[m_id];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline const Matrix& Bone::getAbsoluteTransform() const
 {
-	return m_transform;
+	return m_skeleton->m_transforms[m_id];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline void Bone::setAbsoluteTransform(const Matrix& transform)
 {
-	m_transform = transform;
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////////
-inline void Bone::reset()
-{
-	m_totalWeightTemp = 0.0f;
-	m_totalWeight = 0.0f;
-	//m_type = m_fileType;
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////////
-inline void Bone::resetWithScaleType()
-{
-	m_totalWeightTemp = 0.0f;
-	m_totalWeight = 0.0f;
-	m_type = m_fileType;
+	m_skeleton->m_transforms[m_id] = transform;
+	m_skeleton->markChanged(m_id);
+	//rebuilt from local values on next update
+	m_skeleton->m_dirty[m_id] = 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -336,16 +326,10 @@ inline void Bone::updateTree()
 	updateChildren();
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////
-inline bool Bone::hasWeightLeft() const
-{
-	return (m_totalWeight < 1.0f);
-}
-
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline float Bone::getLodError() const
 {
-	return m_lodError;
+	return m_skeleton->m_lodErrors[m_id];
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -387,6 +371,29 @@ inline void Skeleton::removeCallback()
     m_callback = NULL;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool Skeleton::isBoneChanged(size_t id) const
+{
+	assert(id < m_changed.size());
+	return m_changed[id] != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline size_t Skeleton::getChangedBoneCount() const
+{
+	return m_changedCount;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline void Skeleton::markChanged(int id)
+{
+	if (m_changed[id] == 0)
+	{
+		m_changed[id] = 1;
+		++m_changedCount;
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline const SkeletonResource* Skeleton::getSkeletonResource() const
 {
@@ -406,6 +413,51 @@ inline Bone* Skeleton::getBone(int id)
 	return &(m_bones[ id ]);
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool Skeleton::isBoneActive(int boneId) const
+{
+	assert(boneId >= 0 && boneId < static_cast<int>(m_active.size()));
+	return m_active[boneId] != 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline int Skeleton::getLodParent(int boneId) const
+{
+	assert(boneId >= 0 && boneId < static_cast<int>(m_lodParents.size()));
+	return m_lodParents[boneId];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline const Matrix& Skeleton::getCollapseTransform(int boneId) const
+{
+	assert(boneId >= 0 && boneId < static_cast<int>(m_collapseTransforms.size()));
+	return m_collapseTransforms[boneId];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool Skeleton::isIkChanged() const
+{
+	return m_ikChanged;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool Skeleton::hasWeightLeft(int boneId) const
+{
+	return m_blender.hasWeightLeft(boneId);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline void Skeleton::blendPose(const PoseBuffer& pose, const int* boneIds, size_t count, float weight)
+{
+	m_blender.blend(pose, boneIds, count, weight);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+inline void Skeleton::lockBlend()
+{
+	m_blender.lock();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline const Matrix& Skeleton::getTransform() const
 {
@@ -415,7 +467,11 @@ inline const Matrix& Skeleton::getTransform() const
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 inline void Skeleton::setTransform(const Matrix& transform)
 {
-	m_transform = transform;
+	if (transform != m_transform)
+	{
+		m_transform = transform;
+		m_transformDirty = true;
+	}
 }
 
 }
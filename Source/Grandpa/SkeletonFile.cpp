@@ -8,6 +8,29 @@ namespace grp
 
 static const int CURRENT_VERSION = 0x0100;
 
+#ifdef _GRP_WIN32_THREAD_SAFE
+static volatile LONG s_skeletonSerial = 0;
+#else
+static unsigned long s_skeletonSerial = 0;
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//skeletons may be imported by several loader threads
+static unsigned long nextSkeletonSerial()
+{
+#ifdef _GRP_WIN32_THREAD_SAFE
+	return static_cast<unsigned long>(::InterlockedIncrement(&s_skeletonSerial));
+#else
+	return ++s_skeletonSerial;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+SkeletonFile::SkeletonFile()
+	: m_serial(0)
+{
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 bool SkeletonFile::importFrom(std::istream& input)
 {
@@ -87,7 +110,9 @@ bool SkeletonFile::importFrom(std::istream& input)
 			m_coreBones[bone.parentId].childrenId.push_back(static_cast<int>(i));
 		}
 	}
-	return true;
+	buildUpdateOrder();
+	//a bone missing here sits in a parent loop
+	return m_updateOrder.size() == boneCount;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -95,6 +120,8 @@ void SkeletonFile::clear()
 {
 	m_boneNameMap.clear();
 	m_coreBones.clear();
+	m_updateOrder.clear();
+	m_serial = nextSkeletonSerial();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -110,4 +137,30 @@ int SkeletonFile::addCoreBone(const CoreBone& bone)
 	return id;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkeletonFile::buildUpdateOrder()
+{
+	m_updateOrder.clear();
+	m_updateOrder.reserve(m_coreBones.size());
+	for (size_t i = 0; i < m_coreBones.size(); ++i)
+	{
+		if (m_coreBones[i].parentId < 0)
+		{
+			addToUpdateOrder(static_cast<int>(i));
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkeletonFile::addToUpdateOrder(int id)
+{
+	//depth first, so siblings' subtrees stay contiguous in the order
+	m_updateOrder.push_back(id);
+	const CoreBone& bone = m_coreBones[id];
+	for (size_t i = 0; i < bone.childrenId.size(); ++i)
+	{
+		addToUpdateOrder(bone.childrenId[i]);
+	}
+}
+
 }
@@ -27,6 +27,8 @@ class SkeletonFile : public ContentFile
 	friend class CExporter;
 
 public:
+	SkeletonFile();
+
 	CoreBone* getCoreBone(int id);
 	CoreBone* getCoreBone(const STRING& name);
 
@@ -34,6 +36,12 @@ public:
 
 	const VECTOR(CoreBone)& getCoreBones() const;
 
+	//bone ids with every parent ahead of its children
+	const VECTOR(int)& getUpdateOrder() const;
+
+	//unique for every loaded skeleton, never reused like an address could be
+	unsigned long getSerial() const;
+
 	bool importFrom(std::istream& input);
 
 private:
@@ -41,9 +49,14 @@ private:
 
 	int addCoreBone(const CoreBone& bone);
 
+	void buildUpdateOrder();
+	void addToUpdateOrder(int id);
+
 private:
 	VECTOR(CoreBone)	m_coreBones;
 	MAP(STRING, int)	m_boneNameMap;
+	VECTOR(int)			m_updateOrder;
+	unsigned long		m_serial;
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -85,6 +98,18 @@ inline const VECTOR(CoreBone)& SkeletonFile::getCoreBones() const
 	return m_coreBones;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline const VECTOR(int)& SkeletonFile::getUpdateOrder() const
+{
+	return m_updateOrder;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline unsigned long SkeletonFile::getSerial() const
+{
+	return m_serial;
+}
+
 }
 
 #endif
@@ -2,16 +2,46 @@
 #include "SkinnedMesh.h"
 #include "ContentResource.h"
 #include "Performance.h"
+#include <cfloat>
 
 namespace grp
 {
 
+//above this fraction of vertices to reskin, a full pass is cheaper than a subset
+const float SUBSET_SKIN_RATIO = 0.3f;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//equal up to float error of the collapse multiply
+static bool isSameOffset(const Matrix& a, const Matrix& b)
+{
+	for (int i = 0; i < 16; ++i)
+	{
+		if (fabs(a._M[i] - b._M[i]) > 1e-4f * (1.0f + fabs(b._M[i])))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 SkinnedMesh::SkinnedMesh(const SkinnedMeshResource* resource)
 	: Mesh(resource)
 	, m_resource(resource)
+	, m_vertexMark(0)
+	, m_maxInfluences(MAX_VERTEX_INFLUENCE)
 	, m_updateMode(UPDATE_DEFAULT)
 	, m_gpuSkinning(false)
+	, m_outputBuffer(false)
+	, m_outputEncoding(0)
+	, m_positionRange(Vector3::ZERO, Vector3::ZERO)
+	, m_vertexDirty(true)
+	, m_skinnedChannels(SKIN_POSITION)
+	, m_skinnedInfluences(MAX_VERTEX_INFLUENCE)
+	, m_skinnedVertexCount(0)
+	, m_skinGeneration(0)
+	, m_boundingBoxGeneration(0xffffffff)
+	, m_subsetSkinned(false)
 	, m_weightLod(true)
 {
 	assert(resource != NULL);
@@ -21,11 +51,7 @@ SkinnedMesh::SkinnedMesh(const SkinnedMeshResource* resource)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 SkinnedMesh::~SkinnedMesh()
 {
-	//if gpu skinning, m_dynamicStream.buffer is only a reference to m_resource->getDynamicVertexStream()
-	if (!m_gpuSkinning && m_dynamicStream.buffer != NULL)
-	{
-		GRP_DELETE(m_dynamicStream.buffer);
-	}
+	releaseDynamicBuffer();
 	assert(m_resource != NULL);
 	m_resource->drop();
 }
@@ -41,284 +67,270 @@ void SkinnedMesh::update()
 {
 	PERF_NODE_FUNC();
 
-	assert(m_finalBoneTransforms.size() == m_boneTransforms.size());
+	bool paletteChanged = updatePalette();
+	if (m_gpuSkinning)
 	{
-		PERF_NODE("UpdateMatrix");
-
-		assert(m_resource != NULL);
-		const VECTOR(Matrix)& offsetMatrices = m_resource->getOffsetMatrices();
-		for (size_t i = 0; i < m_finalBoneTransforms.size(); ++i)
+		if (paletteChanged)
 		{
-			if (m_boneTransforms[i] == NULL)
-			{
-				m_finalBoneTransforms[i] = offsetMatrices[i];
-			}
-			else
-			{
-				offsetMatrices[i].multiply_optimized(*m_boneTransforms[i], m_finalBoneTransforms[i]);
-			}
+			++m_skinGeneration;
 		}
-	}
-	if (m_gpuSkinning)
-	{
 		return;
 	}
+	SkinChannels channels;
 	if (!checkVertexFormat(NORMAL) || m_updateMode == UPDATE_POS_ONLY)
 	{
-		updateVertex_PosOnly();
+		channels = SKIN_POSITION;
 	}
 	else if (!checkVertexFormat(TANGENT) || m_updateMode == UPDATE_NO_TANGENT)
 	{
-		updateVertex_NoTangent();
+		channels = SKIN_POSITION_NORMAL;
 	}
 	else
 	{
-		updateVertex();
+		channels = SKIN_POSITION_NORMAL_TANGENT;
+	}
+	if (channels == SKIN_POSITION_NORMAL && (m_dynamicStream.format & TANGENT_QUAT) != 0)
+	{
+		channels = SKIN_POSITION_NORMAL_TANGENT;	//frame can't be encoded without tangent
+	}
+	size_t influences = getWeightLodInfluences();
+	if (!paletteChanged
+		&& !m_vertexDirty
+		&& channels == m_skinnedChannels
+		&& influences == m_skinnedInfluences
+		&& m_vertexCount == m_skinnedVertexCount)
+	{
+		return;	//holding the same pose, vertices are still valid
+	}
+	bool subset = (!m_vertexDirty
+		&& channels == m_skinnedChannels
+		&& influences == m_skinnedInfluences
+		&& m_vertexCount == m_skinnedVertexCount);
+	if ((m_dynamicStream.format & POSITION_UNORM16) != 0)
+	{
+		//range follows the pose, so every vertex is quantized again.
+		//bone boxes hold all skinned positions, blended ones included
+		calculateBoneBoundingBox();
+		m_positionRange = m_boundingBox;
+		subset = false;
+	}
+	bool fullPass = (!subset || !updateVertexSubset(channels, influences));
+	if (fullPass)
+	{
+		updateVertex(channels, influences);
+	}
+	m_vertexDirty = false;
+	m_skinnedChannels = channels;
+	m_skinnedInfluences = influences;
+	m_skinnedVertexCount = m_vertexCount;
+	++m_skinGeneration;
+	m_subsetSkinned = !fullPass;
+	if (fullPass)
+	{
+		//box came out of the pass, subset leaves it to calculateBoundingBox()
+		m_boundingBoxGeneration = m_skinGeneration;
 	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void SkinnedMesh::updateVertex()
+//fewest influences whose error the lod tolerance accepts
+size_t SkinnedMesh::getWeightLodInfluences() const
 {
-	assert(m_resource != NULL);
-	const VECTOR(SkinVertex)& skinVertices = m_resource->getSkinVertices();
-	const unsigned char* srcStream = m_resource->getDynamicVertexStream();
-	
-	const unsigned long format = (POSITION | NORMAL | TANGENT);
-	assert(m_dynamicStream.format == format);
-	size_t stride = m_dynamicStream.stride;
+	if (!m_weightLod)
+	{
+		return MAX_VERTEX_INFLUENCE;
+	}
+	if (m_lodTolerance > m_resource->getWeightLodError(1))
+	{
+		return 1;
+	}
+	if (m_lodTolerance > m_resource->getWeightLodError(2))
+	{
+		return 2;
+	}
+	return MAX_VERTEX_INFLUENCE;
+}
 
-	const unsigned char* srcPositions = srcStream + MeshFile::getDataOffset(format, POSITION);
-	const unsigned char* srcNormals = srcStream + MeshFile::getDataOffset(format, NORMAL);
-	const unsigned char* srcTangents = srcStream + MeshFile::getDataOffset(format, TANGENT);
-	const unsigned char* srcBinormals = srcTangents + sizeof(Vector3);
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SkinnedMesh::updatePalette()
+{
+	PERF_NODE_FUNC();
 
-	assert(m_dynamicStream.buffer != NULL);
-	unsigned char* dstPositions = m_dynamicStream.buffer + MeshFile::getDataOffset(format, POSITION);
-	unsigned char* dstNormals = m_dynamicStream.buffer + MeshFile::getDataOffset(format, NORMAL);
-	unsigned char* dstTangents = m_dynamicStream.buffer + MeshFile::getDataOffset(format, TANGENT);
-	unsigned char* dstBinormals = dstTangents + sizeof(Vector3);
-	const unsigned char* dstPositionStart = dstPositions;	//backup for further usage
-	const unsigned char* dstNormalStart = dstNormals;
-
-	bool oneWeightOnly = (m_weightLod && m_lodTolerance > m_resource->getWeightLodError());
-	for (size_t i = 0;
-		i < m_vertexCount;
-		++i,
-		srcPositions += stride, srcNormals += stride, srcTangents += stride, srcBinormals += stride,
-		dstPositions += stride, dstNormals += stride, dstTangents += stride, dstBinormals += stride)
-	{
-		const SkinVertex& vertexCore = skinVertices[i];
-
-		Vector3& dstPosition = *((Vector3*)dstPositions);
-		Vector3& dstNormal = *((Vector3*)dstNormals);
-		Vector3& dstTangent = *((Vector3*)dstTangents);
-		Vector3& dstBinormal = *((Vector3*)dstBinormals);
-		const Vector3& srcPosition = *((const Vector3*)srcPositions);
-		const Vector3& srcNormal = *((const Vector3*)srcNormals);
-		const Vector3& srcTangent = *((const Vector3*)srcTangents);
-		const Vector3& srcBinormal = *((const Vector3*)srcBinormals);
-
-		if (oneWeightOnly || vertexCore.influences[0].weight > 0.999f)
-		{
-			const Matrix& transform = m_finalBoneTransforms[vertexCore.influences[0].boneIndex];
-			dstTangent = transform.rotateVector3(srcTangent);
-			dstBinormal = transform.rotateVector3(srcBinormal);
-			if (vertexCore.copyNormal < 0)
-			{
-				dstNormal = transform.rotateVector3(srcNormal);
-			}
-			if (vertexCore.copyPosition < 0)
-			{
-				dstPosition = transform.transformVector3(srcPosition);
-			}
+	assert(m_finalBoneTransforms.size() == m_boneTransforms.size());
+	m_changedBones.clear();
+	Matrix transform;
+	bool shared = false;
+	for (size_t i = 0; i < m_finalBoneTransforms.size(); ++i)
+	{
+		if (m_paletteSources[i] != i)
+		{	//pruned bone, copied from its lod parent's entry below
+			shared = true;
+			continue;
 		}
-		else
+		if (m_boneTransforms[i] == NULL)
 		{
-			Matrix totalTransform;
-			for (int j = 0; j < MAX_VERTEX_INFLUENCE; ++j)
-			{
-				//for each bone that influence
-				const VertexInfluence& influence = vertexCore.influences[j];
-				if (influence.weight < MIN_VERTEX_WEIGHT)
-				{
-					break;	//sorted by weight, so we can do this
-				}
-				if (j == 0)
-				{
-					totalTransform = m_finalBoneTransforms[influence.boneIndex] * influence.weight;
-				}
-				else
-				{
-					totalTransform += m_finalBoneTransforms[influence.boneIndex] * influence.weight;
-				}
-			}
-			dstTangent = totalTransform.rotateVector3(srcTangent);
-			dstBinormal = totalTransform.rotateVector3(srcBinormal);
-			if (vertexCore.copyNormal < 0)
-			{
-				dstNormal = totalTransform.rotateVector3(srcNormal);
-			}
-			if (vertexCore.copyPosition < 0)
-			{
-				dstPosition = totalTransform.transformVector3(srcPosition);
-			}
+			transform = m_offsetMatrices[i];
 		}
-
-		if (vertexCore.copyPosition >= 0)
+		else
 		{
-			dstPosition = *((const Vector3*)(dstPositionStart + vertexCore.copyPosition * stride));
+			m_offsetMatrices[i].multiply_optimized(*m_boneTransforms[i], transform);
 		}
-		if (vertexCore.copyNormal >= 0)
+		if (transform != m_finalBoneTransforms[i])
 		{
-			dstNormal = *((const Vector3*)(dstNormalStart + vertexCore.copyNormal * stride));
+			m_finalBoneTransforms[i] = transform;
+			m_changedBones.push_back(static_cast<unsigned long>(i));
 		}
-		else
+	}
+	if (shared)
+	{
+		for (size_t i = 0; i < m_finalBoneTransforms.size(); ++i)
 		{
-			dstNormal.normalize();
+			const Matrix& source = m_finalBoneTransforms[m_paletteSources[i]];
+			if (m_paletteSources[i] != i && source != m_finalBoneTransforms[i])
+			{
+				m_finalBoneTransforms[i] = source;
+				m_changedBones.push_back(static_cast<unsigned long>(i));
+			}
 		}
 	}
+	return !m_changedBones.empty();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void SkinnedMesh::updateVertex_NoTangent()
+void SkinnedMesh::getSkinStreams(SkinChannels channels, SkinStreams& streams) const
 {
-	assert(m_resource != NULL);
-	const VECTOR(SkinVertex)& skinVertices = m_resource->getSkinVertices();
+	//destination is the internal buffer or caller's one, which may be laid out differently
 	const unsigned char* srcStream = m_resource->getDynamicVertexStream();
-	
-	const unsigned long format = m_dynamicStream.format;
-	size_t stride = m_dynamicStream.stride;
-
-	const unsigned char* srcPositions = srcStream + MeshFile::getDataOffset(format, POSITION);
-	const unsigned char* srcNormals = srcStream + MeshFile::getDataOffset(format, NORMAL);
+	const unsigned long srcFormat = m_resource->getDynamicStreamFormat();
+	const unsigned long dstFormat = m_dynamicStream.format;
 
 	assert(m_dynamicStream.buffer != NULL);
-	unsigned char* dstPositions = m_dynamicStream.buffer + MeshFile::getDataOffset(format, POSITION);
-	unsigned char* dstNormals = m_dynamicStream.buffer + MeshFile::getDataOffset(format, NORMAL);
-	const unsigned char* dstPositionStart = dstPositions;	//backup for further usage
-	const unsigned char* dstNormalStart = dstNormals;
-
-	bool oneWeightOnly = (m_weightLod && m_lodTolerance > m_resource->getWeightLodError());
-	for (size_t i = 0;
-		i < m_vertexCount;
-		++i,
-		srcPositions += stride, srcNormals += stride,
-		dstPositions += stride, dstNormals += stride)
+	streams.srcPositions = srcStream + MeshFile::getDataOffset(srcFormat, POSITION);
+	streams.dstPositions = m_dynamicStream.buffer + MeshFile::getDataOffset(dstFormat, POSITION);
+	streams.srcNormals = NULL;
+	streams.dstNormals = NULL;
+	streams.srcTangents = NULL;
+	streams.dstTangents = NULL;
+	streams.srcStride = MeshFile::calculateVertexStride(srcFormat);
+	streams.dstStride = m_dynamicStream.stride;
+	streams.bounds = NULL;
+	streams.dstFormat = dstFormat;
+	streams.positionOffset = m_positionRange.MinEdge;
+	Vector3 extent = m_positionRange.MaxEdge - m_positionRange.MinEdge;
+	streams.positionScale.set(extent.X > 0.0f ? USHRT_MAX / extent.X : 0.0f,
+							extent.Y > 0.0f ? USHRT_MAX / extent.Y : 0.0f,
+							extent.Z > 0.0f ? USHRT_MAX / extent.Z : 0.0f);
+	if (channels != SKIN_POSITION)
 	{
-		const SkinVertex& vertexCore = skinVertices[i];
-
-		Vector3& dstPosition = *((Vector3*)dstPositions);
-		Vector3& dstNormal = *((Vector3*)dstNormals);
-
-		if (vertexCore.copyNormal >= 0)
-		{
-			dstPosition = *((const Vector3*)(dstPositionStart + vertexCore.copyPosition * stride));
-			dstNormal = *((const Vector3*)(dstNormalStart + vertexCore.copyNormal * stride));
-			continue;
-		}
-		const Vector3& srcPosition = *((const Vector3*)srcPositions);
-		const Vector3& srcNormal = *((const Vector3*)srcNormals);
-		if (oneWeightOnly || vertexCore.influences[0].weight > 0.999f)
-		{
-			const Matrix& transform = m_finalBoneTransforms[vertexCore.influences[0].boneIndex];
-			dstNormal = transform.rotateVector3(srcNormal);
-			if (vertexCore.copyPosition < 0)
-			{
-				dstPosition = transform.transformVector3(srcPosition);
-			}
-		}
-		else
-		{
-			for (int j = 0; j < MAX_VERTEX_INFLUENCE; ++j)
-			{
-				const VertexInfluence& influence = vertexCore.influences[j];
-				if (influence.weight < MIN_VERTEX_WEIGHT)
-				{
-					break;
-				}
-				assert(influence.boneIndex < m_finalBoneTransforms.size());
-				const Matrix& transform = m_finalBoneTransforms[influence.boneIndex];
-				if (j == 0)
-				{
-					dstNormal = (transform.rotateVector3(srcNormal) * influence.weight);
-				}
-				else
-				{
-					dstNormal += (transform.rotateVector3(srcNormal) * influence.weight);
-				}
-				if (vertexCore.copyPosition < 0)
-				{
-					if (j == 0)
-					{
-						dstPosition = (transform.transformVector3(srcPosition) * influence.weight);
-					}
-					else
-					{
-						dstPosition += (transform.transformVector3(srcPosition) * influence.weight);
-					}
-				}
-			}
-		}
-		dstNormal.normalize();
-
-		if (vertexCore.copyPosition >= 0)
-		{
-			dstPosition = *((const Vector3*)(dstPositionStart + vertexCore.copyPosition * stride));
-		}
+		streams.srcNormals = srcStream + MeshFile::getDataOffset(srcFormat, NORMAL);
+		streams.dstNormals = m_dynamicStream.buffer + MeshFile::getDataOffset(dstFormat, NORMAL);
+	}
+	if (channels == SKIN_POSITION_NORMAL_TANGENT)
+	{
+		streams.srcTangents = srcStream + MeshFile::getDataOffset(srcFormat, TANGENT);
+		streams.dstTangents = m_dynamicStream.buffer + MeshFile::getDataOffset(dstFormat, TANGENT);
 	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void SkinnedMesh::updateVertex_PosOnly()
+void SkinnedMesh::updateVertex(SkinChannels channels, size_t influences)
 {
 	assert(m_resource != NULL);
-	const VECTOR(SkinVertex)& skinVertices = m_resource->getSkinVertices();
-	const unsigned char* srcStream = m_resource->getDynamicVertexStream();
-	
-	const unsigned long format = m_dynamicStream.format;
-	size_t stride = m_dynamicStream.stride;
-
-	const unsigned char* srcPositions = srcStream + MeshFile::getDataOffset(format, POSITION);
-
-	assert(m_dynamicStream.buffer != NULL);
-	unsigned char* dstPositions = m_dynamicStream.buffer + MeshFile::getDataOffset(format, POSITION);
-	const unsigned char* dstPositionStart = dstPositions;	//backup for further usage
+	if (m_vertexCount == 0)
+	{
+		return;
+	}
+	SkinStreams streams;
+	getSkinStreams(channels, streams);
+	AaBox bounds(Vector3(FLT_MAX, FLT_MAX, FLT_MAX), Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+	streams.bounds = &bounds;
 
-	bool oneWeightOnly = (m_weightLod && m_lodTolerance > m_resource->getWeightLodError());
-	//assert(m_vertexCount == m_resource->getVertexCount());
-	for (size_t i = 0;	i < m_vertexCount; ++i, srcPositions += stride, dstPositions += stride)
+	if (m_resource->hasPackedSkin())
 	{
-		const SkinVertex& vertexCore = skinVertices[i];
+		const PackedSkin& packedSkin = m_resource->getPackedSkin();
+		skinVertices(packedSkin, m_vertexCount, &m_finalBoneTransforms[0], channels, influences, streams);
+		applySkinCopies(packedSkin, m_vertexCount, channels, streams);
+	}
+	else
+	{
+		const VECTOR(SkinVertex)& vertices = m_resource->getSkinVertices();
+		assert(m_vertexCount <= vertices.size());
+		skinVertices(&vertices[0],
+					m_vertexCount,
+					&m_finalBoneTransforms[0],
+					channels,
+					std::min(influences, m_maxInfluences),
+					streams);
+		applySkinCopies(&vertices[0], m_vertexCount, channels, streams);
+	}
+	//copies share positions with their sources, so the box needs nothing from them
+	if (bounds.MinEdge.X <= bounds.MaxEdge.X)
+	{
+		m_boundingBox = bounds;
+	}
+}
 
-		Vector3& dstPosition = *((Vector3*)dstPositions);
-		if (vertexCore.copyPosition >= 0)
-		{
-			dstPosition = *((const Vector3*)(dstPositionStart + vertexCore.copyPosition * stride));
-			continue;
-		}
-		const Vector3& srcPosition = *((const Vector3*)srcPositions);
-		if (oneWeightOnly || vertexCore.influences[0].weight > 0.999f)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SkinnedMesh::updateVertexSubset(SkinChannels channels, size_t influences)
+{
+	assert(m_resource != NULL);
+	if (!m_resource->hasPackedSkin() || m_vertexCount == 0)
+	{
+		return false;
+	}
+	const PackedSkin& packedSkin = m_resource->getPackedSkin();
+	const VECTOR(unsigned int)& starts = packedSkin.boneVertexStarts;
+	size_t maxCount = static_cast<size_t>(m_vertexCount * SUBSET_SKIN_RATIO);
+	size_t influencedCount = 0;
+	for (size_t i = 0; i < m_changedBones.size(); ++i)
+	{
+		unsigned long bone = m_changedBones[i];
+		influencedCount += starts[bone + 1] - starts[bone];
+		if (influencedCount > maxCount)
 		{
-			const Matrix& transform = m_finalBoneTransforms[vertexCore.influences[0].boneIndex];
-			dstPosition = transform.transformVector3(srcPosition);
+			return false;
 		}
-		else
+	}
+
+	//collect every influenced vertex once, marks are never cleared, only the mark changes
+	m_vertexMarks.resize(packedSkin.vertexIds.size(), 0);
+	if (++m_vertexMark == 0)
+	{
+		std::fill(m_vertexMarks.begin(), m_vertexMarks.end(), 0);
+		m_vertexMark = 1;
+	}
+	m_subsetPositions.clear();
+	for (size_t i = 0; i < m_changedBones.size(); ++i)
+	{
+		unsigned long bone = m_changedBones[i];
+		for (unsigned int j = starts[bone]; j < starts[bone + 1]; ++j)
 		{
-			dstPosition = Vector3::ZERO;
-			for (int j = 0; j < MAX_VERTEX_INFLUENCE; ++j)
+			unsigned int position = packedSkin.boneVertices[j];
+			unsigned int vertexId = packedSkin.vertexIds[position];
+			if (vertexId < m_vertexCount && m_vertexMarks[vertexId] != m_vertexMark)
 			{
-				const VertexInfluence& influence = vertexCore.influences[j];
-				if (influence.weight < MIN_VERTEX_WEIGHT)
-				{
-					break;
-				}
-				assert(influence.boneIndex < m_finalBoneTransforms.size());
-				const Matrix& transform = m_finalBoneTransforms[influence.boneIndex];
-				dstPosition += (transform.transformVector3(srcPosition) * influence.weight);
+				m_vertexMarks[vertexId] = m_vertexMark;
+				m_subsetPositions.push_back(position);
 			}
 		}
 	}
+	if (m_subsetPositions.empty())
+	{
+		return true;
+	}
+	std::sort(m_subsetPositions.begin(), m_subsetPositions.end());
+
+	SkinStreams streams;
+	getSkinStreams(channels, streams);
+	skinVertexSubset(packedSkin,
+					&m_subsetPositions[0],
+					m_subsetPositions.size(),
+					&m_finalBoneTransforms[0],
+					channels,
+					influences,
+					streams);
+	applySkinCopySubset(packedSkin, m_vertexCount, &m_vertexMarks[0], m_vertexMark, channels, streams);
+	return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -330,31 +342,58 @@ void SkinnedMesh::build()
 
 	assert(m_resource->getResourceState() == RES_STATE_COMPLETE);
 
-	size_t vertexCount = m_resource->getVertexCount();
-
 	m_staticStream.format = m_resource->getStaticStreamFormat();
 	m_staticStream.stride = MeshFile::calculateVertexStride(m_staticStream.format);
 	m_staticStream.buffer = const_cast<unsigned char*>(m_resource->getStaticVertexStream());
 
-	m_dynamicStream.format = m_resource->getDynamicStreamFormat();
-	m_dynamicStream.stride = MeshFile::calculateVertexStride(m_dynamicStream.format);
-	if (m_gpuSkinning)
-	{
-		m_dynamicStream.buffer = const_cast<unsigned char*>(m_resource->getDynamicVertexStream());
-	}
-	else
-	{
-		m_dynamicStream.buffer = GRP_NEW unsigned char[vertexCount * m_dynamicStream.stride];
-	}
+	allocateDynamicBuffer();
 
 	size_t boneInfluenceCount = m_resource->getBoneNames().size();
 	m_boneTransforms.resize(boneInfluenceCount, NULL);
 	m_boneIds.resize(boneInfluenceCount, -1);
 	m_finalBoneTransforms.resize(boneInfluenceCount);
+	m_offsetMatrices = m_resource->getOffsetMatrices();
+	assert(m_offsetMatrices.size() == boneInfluenceCount);
+	m_paletteSources.resize(boneInfluenceCount);
+	for (size_t i = 0; i < boneInfluenceCount; ++i)
+	{
+		m_paletteSources[i] = static_cast<unsigned long>(i);
+	}
+
+	m_maxInfluences = m_resource->getMaxInfluenceCount();
 
 	setBuilt();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkinnedMesh::setBoneLod(unsigned long boneIndex, int lodParentId, const Matrix* matrix, const Matrix* collapse)
+{
+	assert(boneIndex < m_boneTransforms.size());
+	assert(m_resource != NULL);
+	m_boneTransforms[boneIndex] = matrix;
+	m_paletteSources[boneIndex] = boneIndex;
+	const VECTOR(Matrix)& offsetMatrices = m_resource->getOffsetMatrices();
+	if (collapse == NULL)
+	{
+		m_offsetMatrices[boneIndex] = offsetMatrices[boneIndex];
+		return;
+	}
+	offsetMatrices[boneIndex].multiply_optimized(*collapse, m_offsetMatrices[boneIndex]);
+	//skin bound in skeleton's bind pose collapses onto the lod parent's own offset,
+	//then the entry is a copy of the parent's one instead of another multiply
+	for (size_t i = 0; i < m_boneIds.size(); ++i)
+	{
+		if (m_boneIds[i] == lodParentId)
+		{
+			if (isSameOffset(m_offsetMatrices[boneIndex], offsetMatrices[i]))
+			{
+				m_paletteSources[boneIndex] = static_cast<unsigned long>(i);
+			}
+			break;
+		}
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 size_t SkinnedMesh::getSkinVertexCount() const
 {
@@ -373,7 +412,8 @@ const VertexInfluence* SkinnedMesh::getVertexInfluences(size_t vertexIndex) cons
 		return NULL;
 	}
 	assert(vertexIndex < m_resource->getVertexCount());
-	return &m_resource->getSkinVertices()[vertexIndex].influences[0];
+	m_resource->getVertexInfluences(vertexIndex, m_influences);
+	return m_influences;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -386,6 +426,55 @@ size_t SkinnedMesh::getBBVertexCount() const
 	return 0;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkinnedMesh::calculateBoundingBox()
+{
+	if (m_boundingBoxGeneration == m_skinGeneration)
+	{
+		return;
+	}
+	//packed positions can't be scanned, and scanning after a subset pass would read back
+	//every vertex the subset skipped
+	if (m_gpuSkinning
+		|| m_subsetSkinned
+		|| (m_dynamicStream.format & (POSITION_HALF | POSITION_UNORM16)) != 0)
+	{
+		calculateBoneBoundingBox();
+	}
+	else
+	{
+		Mesh::calculateBoundingBox();
+	}
+	m_boundingBoxGeneration = m_skinGeneration;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkinnedMesh::calculateBoneBoundingBox()
+{
+	assert(m_resource != NULL);
+	const VECTOR(AaBox)& boneBoxes = m_resource->getBoneBoxes();
+	assert(boneBoxes.size() == m_finalBoneTransforms.size());
+	bool first = true;
+	for (size_t i = 0; i < boneBoxes.size(); ++i)
+	{
+		const AaBox& boneBox = boneBoxes[i];
+		if (boneBox.MinEdge.X > boneBox.MaxEdge.X)
+		{
+			continue;	//influences no vertex
+		}
+		AaBox box = m_finalBoneTransforms[i].transformBox(boneBox);
+		if (first)
+		{
+			m_boundingBox = box;
+			first = false;
+		}
+		else
+		{
+			m_boundingBox.addInternalBox(box);
+		}
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void SkinnedMesh::setGpuSkinning(bool on)
 {
@@ -393,19 +482,136 @@ void SkinnedMesh::setGpuSkinning(bool on)
 	{
 		return;
 	}
-	m_gpuSkinning = on;
-
 	if (!isBuilt())
 	{
+		m_gpuSkinning = on;
 		return;
 	}
 	assert(m_resource != NULL && m_resource->getResourceState() == RES_STATE_COMPLETE);
-	if (on)
+	releaseDynamicBuffer();
+	m_gpuSkinning = on;
+	m_outputBuffer = false;
+	allocateDynamicBuffer();
+	//box came from the other path, compute it again
+	m_boundingBoxGeneration = 0xffffffff;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SkinnedMesh::setOutputBuffer(void* buffer, size_t stride, unsigned long format, bool preserved)
+{
+	if (!isBuilt() || m_gpuSkinning)
 	{
-		if (m_dynamicStream.buffer != NULL)
+		return false;
+	}
+	assert(m_resource != NULL);
+	if (buffer == NULL)
+	{
+		if (m_outputBuffer)
 		{
-			GRP_DELETE(m_dynamicStream.buffer);
+			m_outputBuffer = false;
+			allocateDynamicBuffer();
 		}
+		return true;
+	}
+	unsigned long dynamicFormat = m_resource->getDynamicStreamFormat();
+	if ((format & dynamicFormat) != dynamicFormat
+		|| !checkEncoding(format)
+		|| stride < MeshFile::calculateVertexStride(format))
+	{
+		return false;
+	}
+	if (m_outputBuffer
+		&& m_dynamicStream.buffer == buffer
+		&& m_dynamicStream.stride == stride
+		&& m_dynamicStream.format == format)
+	{
+		//same address says nothing about contents, only caller knows they were kept
+		if (!preserved)
+		{
+			m_vertexDirty = true;
+		}
+		return true;
+	}
+	releaseDynamicBuffer();
+	m_outputBuffer = true;
+	m_vertexDirty = true;
+	m_dynamicStream.buffer = static_cast<unsigned char*>(buffer);
+	m_dynamicStream.stride = stride;
+	m_dynamicStream.format = format;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SkinnedMesh::setOutputFormat(unsigned long encoding)
+{
+	if (!isBuilt() || m_gpuSkinning)
+	{
+		return false;
+	}
+	assert(m_resource != NULL);
+	if ((encoding & ~VERTEX_ENCODING) != 0
+		|| !checkEncoding(m_resource->getDynamicStreamFormat() | encoding))
+	{
+		return false;
+	}
+	if (encoding == m_outputEncoding)
+	{
+		return true;
+	}
+	m_outputEncoding = encoding;
+	if (!m_outputBuffer)
+	{
+		releaseDynamicBuffer();
+		allocateDynamicBuffer();
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkinnedMesh::getPositionRange(Vector3& offset, Vector3& scale) const
+{
+	offset = m_positionRange.MinEdge;
+	scale = (m_positionRange.MaxEdge - m_positionRange.MinEdge) * (1.0f / USHRT_MAX);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+bool SkinnedMesh::checkEncoding(unsigned long format)
+{
+	unsigned long encoding = format & VERTEX_ENCODING;
+	if ((encoding & (POSITION_HALF | POSITION_UNORM16)) != 0
+		&& ((encoding & (POSITION_HALF | POSITION_UNORM16)) == (POSITION_HALF | POSITION_UNORM16)
+			|| (format & POSITION) == 0))
+	{
+		return false;
+	}
+	if ((encoding & NORMAL_OCT) != 0
+		&& ((encoding & TANGENT_QUAT) != 0 || (format & NORMAL) == 0))
+	{
+		return false;
+	}
+	if ((encoding & TANGENT_QUAT) != 0
+		&& (format & (NORMAL | TANGENT)) != (NORMAL | TANGENT))
+	{
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkinnedMesh::allocateDynamicBuffer()
+{
+	assert(m_resource != NULL);
+	assert(!m_outputBuffer);
+	m_dynamicStream.format = m_resource->getDynamicStreamFormat();
+	if (!m_gpuSkinning)
+	{
+		m_dynamicStream.format |= m_outputEncoding;
+	}
+	m_dynamicStream.stride = MeshFile::calculateVertexStride(m_dynamicStream.format);
+	m_vertexDirty = true;
+	if (m_gpuSkinning)
+	{
+		//only a reference to resource's stream
 		m_dynamicStream.buffer = const_cast<unsigned char*>(m_resource->getDynamicVertexStream());
 	}
 	else
@@ -414,4 +620,15 @@ void SkinnedMesh::setGpuSkinning(bool on)
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkinnedMesh::releaseDynamicBuffer()
+{
+	//gpu skinning and caller's buffers are not ours
+	if (!m_gpuSkinning && !m_outputBuffer && m_dynamicStream.buffer != NULL)
+	{
+		GRP_DELETE(m_dynamicStream.buffer);
+	}
+	m_dynamicStream.buffer = NULL;
+}
+
 }
@@ -4,6 +4,7 @@
 #include "Mesh.h"
 #include "ISkin.h"
 #include "IResource.h"
+#include "Skinning.h"
 #include <vector>
 
 namespace grp
@@ -58,12 +59,28 @@ public:
 	virtual const VertexInfluence* getVertexInfluences(size_t vertexIndex) const;
 	virtual void setGpuSkinning(bool enable);
 	virtual bool isGpuSkinning() const;
+	virtual bool setOutputBuffer(void* buffer, size_t stride, unsigned long format, bool preserved = false);
+	virtual bool hasOutputBuffer() const;
+	virtual bool setOutputFormat(unsigned long encoding);
+	virtual unsigned long getOutputFormat() const;
+	virtual void getPositionRange(Vector3& offset, Vector3& scale) const;
+	virtual unsigned long getSkinGeneration() const;
 	
 	virtual size_t getBBVertexCount() const;
 
+	//scans skinned vertices, or uses bone boxes if gpu skinning
+	virtual void calculateBoundingBox();
+
+	//union of bind pose bone boxes moved by bone matrices, conservative and needs no vertices
+	void calculateBoneBoundingBox();
+
 public:
 	void setBoneMatrix(unsigned long boneIndex, int boneId, const Matrix* matrix);
 
+	//skin a pruned bone with matrix of its lod parent, collapse is bone's bind pose relative to it.
+	//collapse NULL restores the bone's own offset
+	void setBoneLod(unsigned long boneIndex, int lodParentId, const Matrix* matrix, const Matrix* collapse);
+
 	const VECTOR(int)& getBoneIds() const;
 
 	void update();
@@ -71,19 +88,55 @@ public:
 	void enableWeightLod(bool enable = true);
 
 private:
-	void updateVertex();
-	void updateVertex_NoTangent();
-	void updateVertex_PosOnly();
+	bool updatePalette();
+
+	size_t getWeightLodInfluences() const;
+
+	void getSkinStreams(SkinChannels channels, SkinStreams& streams) const;
+
+	void updateVertex(SkinChannels channels, size_t influences);
+
+	//only vertices influenced by m_changedBones, false if too many of them
+	bool updateVertexSubset(SkinChannels channels, size_t influences);
+
+	void allocateDynamicBuffer();
+	void releaseDynamicBuffer();
+
+	//encodings only for channels in format, at most one for each
+	static bool checkEncoding(unsigned long format);
 
 private:
 	const SkinnedMeshResource*	m_resource;
 	
 	VECTOR(int)				m_boneIds;
 	VECTOR(const Matrix*)	m_boneTransforms;
+	VECTOR(Matrix)			m_offsetMatrices;		//offsets of resource, collapsed for pruned bones
 	VECTOR(Matrix)			m_finalBoneTransforms;
+	VECTOR(unsigned long)	m_paletteSources;		//entry a pruned bone copies its matrix from, itself if none
+	VECTOR(unsigned long)	m_changedBones;			//palette entries changed by last update
+
+	VECTOR(unsigned int)	m_subsetPositions;		//into PackedSkin::vertexIds
+	VECTOR(unsigned int)	m_vertexMarks;			//per vertex, m_vertexMark if in subset
+	unsigned int			m_vertexMark;
+
+	size_t					m_maxInfluences;		//most influences any vertex uses, picks skinning kernel
+
+	mutable VertexInfluence	m_influences[MAX_VERTEX_INFLUENCE];	//returned by getVertexInfluences
 
 	MeshUpdateMode			m_updateMode;
 	bool					m_gpuSkinning;
+	bool					m_outputBuffer;		//m_dynamicStream is caller's buffer
+	unsigned long			m_outputEncoding;	//of internal buffer
+	AaBox					m_positionRange;	//POSITION_UNORM16 is quantized in it
+
+	//vertices are skinned again only when palette or any of these changes
+	bool					m_vertexDirty;
+	SkinChannels			m_skinnedChannels;
+	size_t					m_skinnedInfluences;
+	size_t					m_skinnedVertexCount;
+	unsigned long			m_skinGeneration;
+	unsigned long			m_boundingBoxGeneration;
+	bool					m_subsetSkinned;		//last pass skinned only changed vertices
 	bool					m_weightLod;
 };
 
@@ -144,6 +197,24 @@ inline bool SkinnedMesh::isGpuSkinning() const
 	return m_gpuSkinning;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool SkinnedMesh::hasOutputBuffer() const
+{
+	return m_outputBuffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline unsigned long SkinnedMesh::getOutputFormat() const
+{
+	return m_outputEncoding;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline unsigned long SkinnedMesh::getSkinGeneration() const
+{
+	return m_skinGeneration;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 inline const VECTOR(int)& SkinnedMesh::getBoneIds() const
 {
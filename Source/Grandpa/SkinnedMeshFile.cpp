@@ -2,7 +2,9 @@
 #include "SkinnedMeshFile.h"
 #include "ChunkFileIo.h"
 #include "IMesh.h"
+#include "Skinning.h"
 #include "Performance.h"
+#include <cfloat>
 
 namespace grp
 {
@@ -11,7 +13,9 @@ static const int CURRENT_VERSION = 0x0100;
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 SkinnedMeshFile::SkinnedMeshFile()
-	: m_weightLodError(0.0f)
+	: m_maxInfluenceCount(1)
+	, m_weightLodError(0.0f)
+	, m_pairWeightLodError(0.0f)
 	, m_uniquePosCount(0)
 {
 }
@@ -138,6 +142,15 @@ bool SkinnedMeshFile::importFrom(std::istream& input)
 			break;
 		}
 	}
+	buildPackedSkin();
+	buildBoneBoxes();
+	calculatePairWeightLodError();
+	m_maxInfluenceCount = grp::getMaxInfluenceCount(&m_skinVertices[0], m_skinVertices.size());
+	if (hasPackedSkin())
+	{
+		//everything at runtime works on packed skin, no need to hold vertices twice
+		VECTOR(SkinVertex)().swap(m_skinVertices);
+	}
 	return true;
 }
 
@@ -145,8 +158,49 @@ bool SkinnedMeshFile::importFrom(std::istream& input)
 void SkinnedMeshFile::clear()
 {
 	m_skinVertices.clear();
+	m_packedSkin = PackedSkin();
+	m_maxInfluenceCount = 1;
 	m_boneNames.clear();
 	m_offsetMatrices.clear();
+	m_boneBoxes.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkinnedMeshFile::getVertexInfluences(size_t vertexIndex, VertexInfluence* influences) const
+{
+	assert(vertexIndex < m_vertexCount);
+	if (!m_skinVertices.empty())
+	{
+		std::copy(m_skinVertices[vertexIndex].influences,
+				m_skinVertices[vertexIndex].influences + MAX_VERTEX_INFLUENCE,
+				influences);
+		return;
+	}
+	for (size_t i = 0; i < MAX_VERTEX_INFLUENCE; ++i)
+	{
+		influences[i].boneIndex = 0;
+		influences[i].weight = 0.0f;
+	}
+	//vertex ids of a group are ascending
+	for (size_t i = 0; i < m_packedSkin.groups.size(); ++i)
+	{
+		const SkinGroup& group = m_packedSkin.groups[i];
+		const unsigned int* firstId = &m_packedSkin.vertexIds[group.first];
+		const unsigned int* found = std::lower_bound(firstId, firstId + group.count, vertexIndex);
+		if (found == firstId + group.count || *found != vertexIndex)
+		{
+			continue;
+		}
+		size_t offset = (found - firstId) * group.influenceCount;
+		for (size_t j = 0; j < group.influenceCount; ++j)
+		{
+			influences[j].boneIndex = m_packedSkin.boneIndices[group.boneOffset + offset + j];
+			influences[j].weight = (group.influenceCount == 1)
+									? 1.0f
+									: static_cast<float>(m_packedSkin.weights[group.weightOffset + offset + j]) / USHRT_MAX;
+		}
+		return;
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -229,4 +283,215 @@ bool SkinnedMeshFile::unpackVertex(std::istream& input, SkinVertex& vertex, unsi
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkinnedMeshFile::buildPackedSkin()
+{
+	if (m_boneNames.size() > UCHAR_MAX + 1)
+	{
+		return;
+	}
+	//vertices copying position and normal only need skinning for tangents,
+	//keep them in their own groups so they can be skipped
+	const size_t COPY_KIND_COUNT = 3;
+	VECTOR(unsigned int) groupVertices[MAX_VERTEX_INFLUENCE][COPY_KIND_COUNT];
+	for (size_t i = 0; i < m_skinVertices.size(); ++i)
+	{
+		const SkinVertex& vertex = m_skinVertices[i];
+		size_t influenceCount = 1;
+		if (vertex.influences[0].weight <= 0.999f)
+		{
+			while (influenceCount < MAX_VERTEX_INFLUENCE
+				&& vertex.influences[influenceCount].weight >= MIN_VERTEX_WEIGHT)
+			{
+				++influenceCount;
+			}
+		}
+		size_t copyKind = 0;
+		if (vertex.copyPosition >= 0)
+		{
+			copyKind = (vertex.copyNormal >= 0) ? 2 : 1;
+			SkinCopy copy;
+			copy.target = static_cast<unsigned int>(i);
+			copy.source = static_cast<unsigned int>(vertex.copyPosition);
+			m_packedSkin.positionCopies.push_back(copy);
+		}
+		if (vertex.copyNormal >= 0)
+		{
+			SkinCopy copy;
+			copy.target = static_cast<unsigned int>(i);
+			copy.source = static_cast<unsigned int>(vertex.copyNormal);
+			m_packedSkin.normalCopies.push_back(copy);
+		}
+		groupVertices[influenceCount - 1][copyKind].push_back(static_cast<unsigned int>(i));
+	}
+
+	for (size_t influenceCount = 1; influenceCount <= MAX_VERTEX_INFLUENCE; ++influenceCount)
+	{
+		for (size_t copyKind = 0; copyKind < COPY_KIND_COUNT; ++copyKind)
+		{
+			const VECTOR(unsigned int)& vertexIds = groupVertices[influenceCount - 1][copyKind];
+			if (vertexIds.empty())
+			{
+				continue;
+			}
+			SkinGroup group;
+			group.influenceCount = influenceCount;
+			group.copyPosition = (copyKind > 0);
+			group.copyNormal = (copyKind > 1);
+			group.first = m_packedSkin.vertexIds.size();
+			group.count = vertexIds.size();
+			group.boneOffset = m_packedSkin.boneIndices.size();
+			group.weightOffset = m_packedSkin.weights.size();
+			group.pairWeightOffset = m_packedSkin.pairWeights.size();
+			m_packedSkin.groups.push_back(group);
+
+			m_packedSkin.vertexIds.insert(m_packedSkin.vertexIds.end(), vertexIds.begin(), vertexIds.end());
+			for (size_t i = 0; i < vertexIds.size(); ++i)
+			{
+				const SkinVertex& vertex = m_skinVertices[vertexIds[i]];
+				for (size_t j = 0; j < influenceCount; ++j)
+				{
+					m_packedSkin.boneIndices.push_back(static_cast<unsigned char>(vertex.influences[j].boneIndex));
+					if (influenceCount > 1)
+					{
+						float weight = std::min(std::max(vertex.influences[j].weight, 0.0f), 1.0f);
+						m_packedSkin.weights.push_back(static_cast<unsigned short>(weight * USHRT_MAX + 0.5f));
+					}
+				}
+				if (influenceCount > 2)
+				{
+					float first = std::max(vertex.influences[0].weight, 0.0f);
+					float sum = first + std::max(vertex.influences[1].weight, 0.0f);
+					unsigned short packed = static_cast<unsigned short>(first / sum * USHRT_MAX + 0.5f);
+					m_packedSkin.pairWeights.push_back(packed);
+					m_packedSkin.pairWeights.push_back(USHRT_MAX - packed);
+				}
+			}
+		}
+	}
+
+	//bone to vertex index, counted first then filled
+	size_t boneCount = m_boneNames.size();
+	VECTOR(unsigned int)& starts = m_packedSkin.boneVertexStarts;
+	starts.resize(boneCount + 1, 0);
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		VECTOR(unsigned int) cursors(starts.begin(), starts.end() - 1);
+		for (size_t g = 0; g < m_packedSkin.groups.size(); ++g)
+		{
+			const SkinGroup& group = m_packedSkin.groups[g];
+			const unsigned char* boneIndices = &m_packedSkin.boneIndices[group.boneOffset];
+			for (size_t i = 0; i < group.count; ++i, boneIndices += group.influenceCount)
+			{
+				for (size_t j = 0; j < group.influenceCount; ++j)
+				{
+					size_t bone = boneIndices[j];
+					if (bone >= boneCount
+						|| std::find(boneIndices, boneIndices + j, boneIndices[j]) != boneIndices + j)
+					{
+						continue;	//same bone twice
+					}
+					if (pass == 0)
+					{
+						++starts[bone + 1];
+					}
+					else
+					{
+						m_packedSkin.boneVertices[cursors[bone]++] = static_cast<unsigned int>(group.first + i);
+					}
+				}
+			}
+		}
+		if (pass == 0)
+		{
+			for (size_t b = 0; b < boneCount; ++b)
+			{
+				starts[b + 1] += starts[b];
+			}
+			m_packedSkin.boneVertices.resize(starts[boneCount]);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void SkinnedMeshFile::buildBoneBoxes()
+{
+	m_boneBoxes.clear();
+	m_boneBoxes.resize(m_boneNames.size(),
+		AaBox(Vector3(FLT_MAX, FLT_MAX, FLT_MAX), Vector3(-FLT_MAX, -FLT_MAX, -FLT_MAX)));
+	if (m_dynamicVertexStream == NULL || !checkVertexFormat(POSITION))
+	{
+		return;
+	}
+	unsigned long format = getDynamicStreamFormat();
+	size_t stride = calculateVertexStride(format);
+	const unsigned char* positionPtr = m_dynamicVertexStream + getDataOffset(format, POSITION);
+	for (size_t i = 0; i < m_skinVertices.size(); ++i, positionPtr += stride)
+	{
+		//skinned position is a weighted average of positions transformed by each bone,
+		//so it stays inside the union of the transformed boxes
+		const Vector3& position = *reinterpret_cast<const Vector3*>(positionPtr);
+		const SkinVertex& vertex = m_skinVertices[i];
+		for (size_t j = 0; j < MAX_VERTEX_INFLUENCE; ++j)
+		{
+			const VertexInfluence& influence = vertex.influences[j];
+			if (j > 0 && influence.weight < MIN_VERTEX_WEIGHT)
+			{
+				break;
+			}
+			if (influence.boneIndex < m_boneBoxes.size())
+			{
+				m_boneBoxes[influence.boneIndex].addInternalPoint(position);
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//largest distance in bind pose between fully weighted position and the one from the first
+//two influences renormalized, every influence moves the position by its own offset matrix
+void SkinnedMeshFile::calculatePairWeightLodError()
+{
+	m_pairWeightLodError = 0.0f;
+	if (m_dynamicVertexStream == NULL || !checkVertexFormat(POSITION))
+	{
+		return;
+	}
+	unsigned long format = getDynamicStreamFormat();
+	size_t stride = calculateVertexStride(format);
+	const unsigned char* positionPtr = m_dynamicVertexStream + getDataOffset(format, POSITION);
+	for (size_t i = 0; i < m_skinVertices.size(); ++i, positionPtr += stride)
+	{
+		const SkinVertex& vertex = m_skinVertices[i];
+		if (vertex.influences[2].weight < MIN_VERTEX_WEIGHT)
+		{
+			continue;	//two influences at most, nothing dropped
+		}
+		const Vector3& position = *reinterpret_cast<const Vector3*>(positionPtr);
+		Vector3 correctPosition(Vector3::ZERO);
+		Vector3 pairPosition(Vector3::ZERO);
+		float pairWeight = 0.0f;
+		for (size_t j = 0; j < MAX_VERTEX_INFLUENCE; ++j)
+		{
+			const VertexInfluence& influence = vertex.influences[j];
+			if (influence.weight < MIN_VERTEX_WEIGHT || influence.boneIndex >= m_offsetMatrices.size())
+			{
+				break;
+			}
+			Vector3 influencePosition = m_offsetMatrices[influence.boneIndex].transformVector3(position);
+			correctPosition += influence.weight * influencePosition;
+			if (j < 2)
+			{
+				pairPosition += influence.weight * influencePosition;
+				pairWeight += influence.weight;
+			}
+		}
+		if (pairWeight > 0.0f)
+		{
+			float error = correctPosition.distance(pairPosition * (1.0f / pairWeight));
+			m_pairWeightLodError = std::max(m_pairWeightLodError, error);
+		}
+	}
+}
+
 }
@@ -23,6 +23,44 @@ struct SkinVertex
 	int					copyNormal;
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//vertices with the same influence count and copy flags, sorted by vertex index
+struct SkinGroup
+{
+	size_t	influenceCount;
+	bool	copyPosition;		//every vertex takes position from another vertex
+	bool	copyNormal;			//and normal too
+	size_t	first;				//into PackedSkin::vertexIds
+	size_t	count;
+	size_t	boneOffset;			//into PackedSkin::boneIndices, influenceCount per vertex
+	size_t	weightOffset;		//into PackedSkin::weights, none for single influence
+	size_t	pairWeightOffset;	//into PackedSkin::pairWeights, only for more than 2 influences
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+struct SkinCopy
+{
+	unsigned int	target;
+	unsigned int	source;		//always less than target
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//compact form of skin vertices used by cpu skinning, indices are 32 bit on every platform
+struct PackedSkin
+{
+	VECTOR(SkinGroup)		groups;
+	VECTOR(unsigned int)	vertexIds;
+	VECTOR(unsigned char)	boneIndices;
+	VECTOR(unsigned short)	weights;		//scaled to USHRT_MAX
+	VECTOR(unsigned short)	pairWeights;	//first two weights renormalized, for 2 influence weight lod
+	VECTOR(SkinCopy)		positionCopies;	//sorted by target
+	VECTOR(SkinCopy)		normalCopies;
+	//vertices influenced by bone b are boneVertices[boneVertexStarts[b]] to
+	//boneVertices[boneVertexStarts[b + 1]], as ascending indices into vertexIds
+	VECTOR(unsigned int)	boneVertexStarts;
+	VECTOR(unsigned int)	boneVertices;
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 class SkinnedMeshFile : public MeshFile
 {
@@ -38,11 +76,26 @@ public:
 	const VECTOR(float)& getBoneMaxDistances() const;
 	const VECTOR(Matrix)& getOffsetMatrices() const;
 
+	//bind pose box of the vertices each bone influences, min > max if none
+	const VECTOR(AaBox)& getBoneBoxes() const;
+
+	//only kept if there is no packed skin
 	const VECTOR(SkinVertex)& getSkinVertices() const;
 
+	//empty if bone indices don't fit in 8 bits
+	const PackedSkin& getPackedSkin() const;
+	bool hasPackedSkin() const;
+
+	//decoded from packed skin if skin vertices are dropped, weights are quantized then
+	void getVertexInfluences(size_t vertexIndex, VertexInfluence* influences) const;
+
+	//most influences any vertex uses
+	size_t getMaxInfluenceCount() const;
+
 	virtual bool importFrom(std::istream& input);
 
-	float getWeightLodError() const;
+	//error caused by skinning with only the first influenceCount influences, 1 or 2
+	float getWeightLodError(size_t influenceCount = 1) const;
 
 	size_t getUniquePosCount() const;
 
@@ -51,6 +104,12 @@ private:
 
 	bool unpackVertex(std::istream& input, SkinVertex& vertex, unsigned char* &buffer);
 
+	void buildPackedSkin();
+
+	void buildBoneBoxes();
+
+	void calculatePairWeightLodError();
+
 private:
 	void clear();
 
@@ -58,8 +117,12 @@ private:
 	VECTOR(STRING)		m_boneNames;
 	VECTOR(float)		m_boneMaxDistances;
 	VECTOR(Matrix)		m_offsetMatrices;
-	VECTOR(SkinVertex)	m_skinVertices;
+	VECTOR(AaBox)		m_boneBoxes;
+	VECTOR(SkinVertex)	m_skinVertices;		//dropped once packed
+	PackedSkin			m_packedSkin;
+	size_t				m_maxInfluenceCount;
 	float				m_weightLodError;	//error caused by ignoring weights other than the 1st one
+	float				m_pairWeightLodError;	//same for the first two, measured on load like exporter does
 	size_t				m_uniquePosCount;
 };
 
@@ -81,6 +144,24 @@ inline const VECTOR(SkinVertex)& SkinnedMeshFile::getSkinVertices() const
 	return m_skinVertices;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline const PackedSkin& SkinnedMeshFile::getPackedSkin() const
+{
+	return m_packedSkin;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline bool SkinnedMeshFile::hasPackedSkin() const
+{
+	return !m_packedSkin.groups.empty();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline size_t SkinnedMeshFile::getMaxInfluenceCount() const
+{
+	return m_maxInfluenceCount;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 inline const VECTOR(STRING)& SkinnedMeshFile::getBoneNames() const
 {
@@ -100,9 +181,16 @@ inline const VECTOR(Matrix)& SkinnedMeshFile::getOffsetMatrices() const
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-inline float SkinnedMeshFile::getWeightLodError() const
+inline const VECTOR(AaBox)& SkinnedMeshFile::getBoneBoxes() const
+{
+	return m_boneBoxes;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline float SkinnedMeshFile::getWeightLodError(size_t influenceCount) const
 {
-	return m_weightLodError;
+	assert(influenceCount == 1 || influenceCount == 2);
+	return (influenceCount == 1) ? m_weightLodError : m_pairWeightLodError;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
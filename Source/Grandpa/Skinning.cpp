@@ -0,0 +1,972 @@
+#include "Precompiled.h"
+#include "Skinning.h"
+#include "SkinnedMeshFile.h"
+#include "Simd.h"
+#include "Performance.h"
+#include <cfloat>
+
+namespace grp
+{
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//matrices and weights blended for one vertex, unused slots repeat the first matrix with weight 0
+template<int MAX_INFLUENCES>
+struct Influences
+{
+	const float*	matrices[MAX_INFLUENCES];
+	float			weights[MAX_INFLUENCES];
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//vertices in file order
+struct SkinVertexSource
+{
+	const SkinVertex*	vertices;
+
+	size_t getVertexId(size_t i) const
+	{
+		return i;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//one group of packed skin
+struct PackedSource
+{
+	const unsigned int*		vertexIds;
+	const unsigned char*	boneIndices;
+	const unsigned short*	weights;
+	const unsigned short*	pairWeights;
+	size_t					influenceCount;
+
+	size_t getVertexId(size_t i) const
+	{
+		return vertexIds[i];
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//some vertices of one group of packed skin
+struct PackedSubsetSource
+{
+	PackedSource			group;
+	const unsigned int*		positions;		//into PackedSkin::vertexIds
+	size_t					first;			//of group in PackedSkin::vertexIds
+
+	size_t getVertexId(size_t i) const
+	{
+		return group.getVertexId(positions[i] - first);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<int MAX_INFLUENCES>
+inline void gatherInfluences(const SkinVertexSource& source, size_t index, const Matrix* palette, Influences<MAX_INFLUENCES>& out)
+{
+	const SkinVertex& vertex = source.vertices[index];
+	const float* first = palette[vertex.influences[0].boneIndex]._M;
+	out.matrices[0] = first;
+	out.weights[0] = 1.0f;
+	if (MAX_INFLUENCES == 1 || vertex.influences[0].weight > 0.999f)
+	{
+		for (int j = 1; j < MAX_INFLUENCES; ++j)
+		{
+			out.matrices[j] = first;
+			out.weights[j] = 0.0f;
+		}
+		return;
+	}
+	out.weights[0] = vertex.influences[0].weight;
+	float sum = out.weights[0];
+	for (int j = 1; j < MAX_INFLUENCES; ++j)
+	{
+		//sorted by weight, so everything after a light one is light too
+		const VertexInfluence& influence = vertex.influences[j];
+		bool used = (influence.weight >= MIN_VERTEX_WEIGHT);
+		out.matrices[j] = used ? palette[influence.boneIndex]._M : first;
+		out.weights[j] = used ? influence.weight : 0.0f;
+		sum += out.weights[j];
+	}
+	if (MAX_INFLUENCES < MAX_VERTEX_INFLUENCE && sum < 0.999f)
+	{
+		//weight lod dropped some influences, the rest still has to add up to 1
+		for (int j = 0; j < MAX_INFLUENCES; ++j)
+		{
+			out.weights[j] /= sum;
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//MAX_INFLUENCES is group's influence count, or 1 or 2 to keep the first ones of a larger group
+template<int MAX_INFLUENCES>
+inline void gatherInfluences(const PackedSource& source, size_t index, const Matrix* palette, Influences<MAX_INFLUENCES>& out)
+{
+	if (MAX_INFLUENCES == 1)
+	{
+		out.matrices[0] = palette[source.boneIndices[index * source.influenceCount]]._M;
+		out.weights[0] = 1.0f;
+		return;
+	}
+	if (MAX_INFLUENCES == 2 && source.influenceCount > 2)
+	{
+		//weight lod keeps the first two, renormalized on load
+		const unsigned char* boneIndices = source.boneIndices + index * source.influenceCount;
+		const unsigned short* weights = source.pairWeights + index * 2;
+		for (int j = 0; j < MAX_INFLUENCES; ++j)
+		{
+			out.matrices[j] = palette[boneIndices[j]]._M;
+			out.weights[j] = weights[j] * (1.0f / USHRT_MAX);
+		}
+		return;
+	}
+	assert(source.influenceCount == MAX_INFLUENCES);
+	const unsigned char* boneIndices = source.boneIndices + index * MAX_INFLUENCES;
+	const unsigned short* weights = source.weights + index * MAX_INFLUENCES;
+	for (int j = 0; j < MAX_INFLUENCES; ++j)
+	{
+		out.matrices[j] = palette[boneIndices[j]]._M;
+		out.weights[j] = weights[j] * (1.0f / USHRT_MAX);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<int MAX_INFLUENCES>
+inline void gatherInfluences(const PackedSubsetSource& source, size_t index, const Matrix* palette, Influences<MAX_INFLUENCES>& out)
+{
+	gatherInfluences<MAX_INFLUENCES>(source.group, source.positions[index] - source.first, palette, out);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//grows streams.bounds by lanes of min and max, count floats per axis
+inline void mergeBounds(const SkinStreams& streams, const float* minEdge, const float* maxEdge, size_t count)
+{
+	if (streams.bounds == NULL)
+	{
+		return;
+	}
+	Vector3& boxMin = streams.bounds->MinEdge;
+	Vector3& boxMax = streams.bounds->MaxEdge;
+	for (size_t i = 0; i < count; ++i)
+	{
+		boxMin.X = std::min(boxMin.X, minEdge[i]);
+		boxMin.Y = std::min(boxMin.Y, minEdge[count + i]);
+		boxMin.Z = std::min(boxMin.Z, minEdge[count * 2 + i]);
+		boxMax.X = std::max(boxMax.X, maxEdge[i]);
+		boxMax.Y = std::max(boxMax.Y, maxEdge[count + i]);
+		boxMax.Z = std::max(boxMax.Z, maxEdge[count * 2 + i]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//round to nearest even, too large goes to infinity and too small to zero
+inline unsigned short floatToHalf(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	unsigned short sign = static_cast<unsigned short>((bits >> 16) & 0x8000);
+	unsigned int magnitude = bits & 0x7fffffff;
+	if (magnitude >= 0x47800000)
+	{
+		return sign | ((magnitude > 0x7f800000) ? 0x7e00 : 0x7c00);
+	}
+	if (magnitude < 0x38800000)
+	{
+		return sign;
+	}
+	magnitude += 0x00000fff + ((magnitude >> 13) & 1);
+	return sign | static_cast<unsigned short>((magnitude - 0x38000000) >> 13);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline short toSnorm16(float value)
+{
+	value = std::min(std::max(value, -1.0f), 1.0f) * 32767.0f;
+	return static_cast<short>(value >= 0.0f ? value + 0.5f : value - 0.5f);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline unsigned short toUnorm16(float value)
+{
+	value = std::min(std::max(value, 0.0f), 65535.0f);
+	return static_cast<unsigned short>(value + 0.5f);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//direction projected on octahedron, lower half folded over, length is lost
+inline void encodeOctahedral(float x, float y, float z, short* out)
+{
+	float sum = fabs(x) + fabs(y) + fabs(z);
+	if (sum == 0.0f)
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+	float u = x / sum;
+	float v = y / sum;
+	if (z < 0.0f)
+	{
+		float foldedU = (1.0f - fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+		v = (1.0f - fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+		u = foldedU;
+	}
+	out[0] = toSnorm16(u);
+	out[1] = toSnorm16(v);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//rotation of rows tangent, normal x tangent, normal. tangent is made orthogonal to normal
+//and binormal only decides handedness, kept in sign of w which is never 0
+inline void encodeTangentFrame(const Vector3& normal, const Vector3& tangent, const Vector3& binormal, short* out)
+{
+	Vector3 t = tangent - normal * normal.dot(tangent);
+	if (t.lengthSq() < 1e-12f)
+	{
+		//no usable tangent, any one orthogonal to normal will do
+		t = (fabs(normal.X) < 0.9f) ? Vector3(1.0f, 0.0f, 0.0f).cross(normal) : Vector3(0.0f, 1.0f, 0.0f).cross(normal);
+	}
+	t.normalize();
+	Vector3 b = normal.cross(t);
+	Matrix frame(t.X, t.Y, t.Z, 0.0f,
+				b.X, b.Y, b.Z, 0.0f,
+				normal.X, normal.Y, normal.Z, 0.0f,
+				0.0f, 0.0f, 0.0f, 1.0f);
+	Quaternion q(frame);
+	q.normalize();
+	if (q.W < 0.0f)
+	{
+		q = Quaternion(-q.X, -q.Y, -q.Z, -q.W);
+	}
+	static const float MIN_W = 1.0f / 32767.0f;
+	if (q.W < MIN_W)
+	{
+		float scale = sqrtf(1.0f - MIN_W * MIN_W);
+		q = Quaternion(q.X * scale, q.Y * scale, q.Z * scale, MIN_W);
+	}
+	if (b.dot(binormal) < 0.0f)
+	{
+		q = Quaternion(-q.X, -q.Y, -q.Z, -q.W);
+	}
+	out[0] = toSnorm16(q.X);
+	out[1] = toSnorm16(q.Y);
+	out[2] = toSnorm16(q.Z);
+	out[3] = toSnorm16(q.W);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void storePosition(const SkinStreams& streams, unsigned char* dst, float x, float y, float z)
+{
+	if ((streams.dstFormat & POSITION_HALF) != 0)
+	{
+		unsigned short* packed = (unsigned short*)dst;
+		packed[0] = floatToHalf(x);
+		packed[1] = floatToHalf(y);
+		packed[2] = floatToHalf(z);
+		packed[3] = 0x3c00;
+	}
+	else if ((streams.dstFormat & POSITION_UNORM16) != 0)
+	{
+		unsigned short* packed = (unsigned short*)dst;
+		packed[0] = toUnorm16((x - streams.positionOffset.X) * streams.positionScale.X);
+		packed[1] = toUnorm16((y - streams.positionOffset.Y) * streams.positionScale.Y);
+		packed[2] = toUnorm16((z - streams.positionOffset.Z) * streams.positionScale.Z);
+		packed[3] = USHRT_MAX;
+	}
+	else
+	{
+		((Vector3*)dst)->set(x, y, z);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//normal, tangent or binormal
+inline void storeDirection(const SkinStreams& streams, unsigned char* dst, float x, float y, float z)
+{
+	if ((streams.dstFormat & NORMAL_OCT) != 0)
+	{
+		encodeOctahedral(x, y, z, (short*)dst);
+	}
+	else
+	{
+		((Vector3*)dst)->set(x, y, z);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline size_t getBinormalOffset(const SkinStreams& streams)
+{
+	return ((streams.dstFormat & NORMAL_OCT) != 0) ? 2 * sizeof(short) : sizeof(Vector3);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//copy of an already stored vertex, in whatever encoding
+inline void copyVertexData(unsigned char* stream, size_t size, size_t stride, unsigned long target, unsigned long source)
+{
+	memcpy(stream + target * stride, stream + source * stride, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//a tangent frame carries tangent of its own vertex, so normals are not copied into it
+inline bool isNormalCopied(const SkinStreams& streams, SkinChannels channels)
+{
+	return (channels != SKIN_POSITION && (streams.dstFormat & TANGENT_QUAT) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<int CHANNELS, int MAX_INFLUENCES, class Source>
+static void skinScalar(const Source& source,
+						size_t begin,
+						size_t end,
+						const Matrix* palette,
+						const SkinStreams& streams)
+{
+	float minEdge[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float maxEdge[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t i = begin; i < end; ++i)
+	{
+		Influences<MAX_INFLUENCES> influences;
+		gatherInfluences<MAX_INFLUENCES>(source, i, palette, influences);
+		Matrix transform;
+		for (int k = 0; k < 16; ++k)
+		{
+			float element = influences.matrices[0][k] * influences.weights[0];
+			for (int j = 1; j < MAX_INFLUENCES; ++j)
+			{
+				element += influences.matrices[j][k] * influences.weights[j];
+			}
+			transform._M[k] = element;
+		}
+
+		size_t vertexId = source.getVertexId(i);
+		size_t srcOffset = vertexId * streams.srcStride;
+		size_t dstOffset = vertexId * streams.dstStride;
+		Vector3 position = transform.transformVector3(*(const Vector3*)(streams.srcPositions + srcOffset));
+		storePosition(streams, streams.dstPositions + dstOffset, position.X, position.Y, position.Z);
+		minEdge[0] = std::min(minEdge[0], position.X);
+		minEdge[1] = std::min(minEdge[1], position.Y);
+		minEdge[2] = std::min(minEdge[2], position.Z);
+		maxEdge[0] = std::max(maxEdge[0], position.X);
+		maxEdge[1] = std::max(maxEdge[1], position.Y);
+		maxEdge[2] = std::max(maxEdge[2], position.Z);
+		if (CHANNELS == SKIN_POSITION)
+		{
+			continue;
+		}
+		Vector3 normal = transform.rotateVector3(*(const Vector3*)(streams.srcNormals + srcOffset));
+		normal.normalize();
+		if (CHANNELS != SKIN_POSITION_NORMAL_TANGENT)
+		{
+			storeDirection(streams, streams.dstNormals + dstOffset, normal.X, normal.Y, normal.Z);
+			continue;
+		}
+		const Vector3* srcTangent = (const Vector3*)(streams.srcTangents + srcOffset);
+		Vector3 tangent = transform.rotateVector3(srcTangent[0]);
+		Vector3 binormal = transform.rotateVector3(srcTangent[1]);
+		if ((streams.dstFormat & TANGENT_QUAT) != 0)
+		{
+			encodeTangentFrame(normal, tangent, binormal, (short*)(streams.dstNormals + dstOffset));
+			continue;
+		}
+		unsigned char* dstTangent = streams.dstTangents + dstOffset;
+		storeDirection(streams, streams.dstNormals + dstOffset, normal.X, normal.Y, normal.Z);
+		storeDirection(streams, dstTangent, tangent.X, tangent.Y, tangent.Z);
+		storeDirection(streams, dstTangent + getBinormalOffset(streams), binormal.X, binormal.Y, binormal.Z);
+	}
+	mergeBounds(streams, minEdge, maxEdge, 1);
+}
+
+#if defined (GRP_SSE2)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void loadVector3x4(const unsigned char* src, const size_t* offsets, __m128& x, __m128& y, __m128& z)
+{
+	const Vector3& v0 = *(const Vector3*)(src + offsets[0]);
+	const Vector3& v1 = *(const Vector3*)(src + offsets[1]);
+	const Vector3& v2 = *(const Vector3*)(src + offsets[2]);
+	const Vector3& v3 = *(const Vector3*)(src + offsets[3]);
+	x = _mm_set_ps(v3.X, v2.X, v1.X, v0.X);
+	y = _mm_set_ps(v3.Y, v2.Y, v1.Y, v0.Y);
+	z = _mm_set_ps(v3.Z, v2.Z, v1.Z, v0.Z);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//Store is storePosition or storeDirection, encoding is done lane by lane
+template<void Store(const SkinStreams&, unsigned char*, float, float, float)>
+inline void storeVector3x4(const SkinStreams& streams, unsigned char* dst, const size_t* offsets, __m128 x, __m128 y, __m128 z)
+{
+	float lanes[3][4];
+	_mm_storeu_ps(lanes[0], x);
+	_mm_storeu_ps(lanes[1], y);
+	_mm_storeu_ps(lanes[2], z);
+	for (size_t i = 0; i < 4; ++i)
+	{
+		Store(streams, dst + offsets[i], lanes[0][i], lanes[1][i], lanes[2][i]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void storeTangentFramex4(unsigned char* dst, const size_t* offsets, const __m128 (*directions)[3])
+{
+	float lanes[3][3][4];
+	for (int d = 0; d < 3; ++d)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			_mm_storeu_ps(lanes[d][c], directions[d][c]);
+		}
+	}
+	for (size_t i = 0; i < 4; ++i)
+	{
+		encodeTangentFrame(Vector3(lanes[0][0][i], lanes[0][1][i], lanes[0][2][i]),
+							Vector3(lanes[1][0][i], lanes[1][1][i], lanes[1][2][i]),
+							Vector3(lanes[2][0][i], lanes[2][1][i], lanes[2][2][i]),
+							(short*)(dst + offsets[i]));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+inline void normalizeSse2(__m128& x, __m128& y, __m128& z)
+{
+	__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+	//zero length is left alone like Vector3::normalize
+	__m128 zero = _mm_cmpeq_ps(length, _mm_setzero_ps());
+	length = _mm_or_ps(_mm_andnot_ps(zero, length), _mm_and_ps(zero, _mm_set1_ps(1.0f)));
+	x = _mm_div_ps(x, length);
+	y = _mm_div_ps(y, length);
+	z = _mm_div_ps(z, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//4 vertices at a time, blended matrices are transposed so every element holds 4 vertices
+template<int CHANNELS, int MAX_INFLUENCES, class Source>
+static void skinSse2(const Source& source,
+					size_t begin,
+					size_t end,
+					const Matrix* palette,
+					const SkinStreams& streams)
+{
+	__m128 minEdge[3] = { _mm_set1_ps(FLT_MAX), _mm_set1_ps(FLT_MAX), _mm_set1_ps(FLT_MAX) };
+	__m128 maxEdge[3] = { _mm_set1_ps(-FLT_MAX), _mm_set1_ps(-FLT_MAX), _mm_set1_ps(-FLT_MAX) };
+	for (size_t i = begin; i + 4 <= end; i += 4)
+	{
+		size_t srcOffsets[4];
+		size_t dstOffsets[4];
+		__m128 rows[4][4];	//vertex, row
+		for (size_t v = 0; v < 4; ++v)
+		{
+			size_t vertexId = source.getVertexId(i + v);
+			srcOffsets[v] = vertexId * streams.srcStride;
+			dstOffsets[v] = vertexId * streams.dstStride;
+			Influences<MAX_INFLUENCES> influences;
+			gatherInfluences<MAX_INFLUENCES>(source, i + v, palette, influences);
+			__m128 weight = _mm_set1_ps(influences.weights[0]);
+			const float* m = influences.matrices[0];
+			for (int r = 0; r < 4; ++r)
+			{
+				rows[v][r] = _mm_mul_ps(_mm_loadu_ps(m + r * 4), weight);
+			}
+			for (int j = 1; j < MAX_INFLUENCES; ++j)
+			{
+				weight = _mm_set1_ps(influences.weights[j]);
+				m = influences.matrices[j];
+				for (int r = 0; r < 4; ++r)
+				{
+					rows[v][r] = _mm_add_ps(rows[v][r], _mm_mul_ps(_mm_loadu_ps(m + r * 4), weight));
+				}
+			}
+		}
+		//e[r][c] is element _rc of all 4 vertices
+		__m128 e[4][4];
+		for (int r = 0; r < 4; ++r)
+		{
+			e[r][0] = rows[0][r];
+			e[r][1] = rows[1][r];
+			e[r][2] = rows[2][r];
+			e[r][3] = rows[3][r];
+			_MM_TRANSPOSE4_PS(e[r][0], e[r][1], e[r][2], e[r][3]);
+		}
+
+		__m128 x, y, z;
+		loadVector3x4(streams.srcPositions, srcOffsets, x, y, z);
+		__m128 p[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			p[c] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, e[0][c]), _mm_mul_ps(y, e[1][c])), _mm_mul_ps(z, e[2][c])), e[3][c]);
+			minEdge[c] = _mm_min_ps(minEdge[c], p[c]);
+			maxEdge[c] = _mm_max_ps(maxEdge[c], p[c]);
+		}
+		storeVector3x4<storePosition>(streams, streams.dstPositions, dstOffsets, p[0], p[1], p[2]);
+		if (CHANNELS == SKIN_POSITION)
+		{
+			continue;
+		}
+
+		const unsigned char* sources[3] = { streams.srcNormals, streams.srcTangents, streams.srcTangents + sizeof(Vector3) };
+		unsigned char* targets[3] = { streams.dstNormals, streams.dstTangents, streams.dstTangents + getBinormalOffset(streams) };
+		int directionCount = (CHANNELS == SKIN_POSITION_NORMAL_TANGENT) ? 3 : 1;
+		__m128 r[3][3];	//direction, axis
+		for (int d = 0; d < directionCount; ++d)
+		{
+			loadVector3x4(sources[d], srcOffsets, x, y, z);
+			r[d][0] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, e[0][0]), _mm_mul_ps(y, e[1][0])), _mm_mul_ps(z, e[2][0]));
+			r[d][1] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, e[0][1]), _mm_mul_ps(y, e[1][1])), _mm_mul_ps(z, e[2][1]));
+			r[d][2] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, e[0][2]), _mm_mul_ps(y, e[1][2])), _mm_mul_ps(z, e[2][2]));
+			if (d == 0)
+			{	//only normal is normalized, tangent and binormal keep their length
+				normalizeSse2(r[d][0], r[d][1], r[d][2]);
+			}
+		}
+		if (CHANNELS == SKIN_POSITION_NORMAL_TANGENT && (streams.dstFormat & TANGENT_QUAT) != 0)
+		{
+			storeTangentFramex4(streams.dstNormals, dstOffsets, r);
+			continue;
+		}
+		for (int d = 0; d < directionCount; ++d)
+		{
+			storeVector3x4<storeDirection>(streams, targets[d], dstOffsets, r[d][0], r[d][1], r[d][2]);
+		}
+	}
+	float minLanes[3][4];
+	float maxLanes[3][4];
+	for (int c = 0; c < 3; ++c)
+	{
+		_mm_storeu_ps(minLanes[c], minEdge[c]);
+		_mm_storeu_ps(maxLanes[c], maxEdge[c]);
+	}
+	mergeBounds(streams, minLanes[0], maxLanes[0], 4);
+}
+#endif
+
+#if defined (GRP_AVX2)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+GRP_AVX2_FUNCTION inline void loadVector3x8(const unsigned char* src, const size_t* offsets, __m256& x, __m256& y, __m256& z)
+{
+	const Vector3* v[8];
+	for (size_t i = 0; i < 8; ++i)
+	{
+		v[i] = (const Vector3*)(src + offsets[i]);
+	}
+	x = _mm256_set_ps(v[7]->X, v[6]->X, v[5]->X, v[4]->X, v[3]->X, v[2]->X, v[1]->X, v[0]->X);
+	y = _mm256_set_ps(v[7]->Y, v[6]->Y, v[5]->Y, v[4]->Y, v[3]->Y, v[2]->Y, v[1]->Y, v[0]->Y);
+	z = _mm256_set_ps(v[7]->Z, v[6]->Z, v[5]->Z, v[4]->Z, v[3]->Z, v[2]->Z, v[1]->Z, v[0]->Z);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<void Store(const SkinStreams&, unsigned char*, float, float, float)>
+GRP_AVX2_FUNCTION inline void storeVector3x8(const SkinStreams& streams, unsigned char* dst, const size_t* offsets, __m256 x, __m256 y, __m256 z)
+{
+	float lanes[3][8];
+	_mm256_storeu_ps(lanes[0], x);
+	_mm256_storeu_ps(lanes[1], y);
+	_mm256_storeu_ps(lanes[2], z);
+	for (size_t i = 0; i < 8; ++i)
+	{
+		Store(streams, dst + offsets[i], lanes[0][i], lanes[1][i], lanes[2][i]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+GRP_AVX2_FUNCTION inline void storeTangentFramex8(unsigned char* dst, const size_t* offsets, const __m256 (*directions)[3])
+{
+	float lanes[3][3][8];
+	for (int d = 0; d < 3; ++d)
+	{
+		for (int c = 0; c < 3; ++c)
+		{
+			_mm256_storeu_ps(lanes[d][c], directions[d][c]);
+		}
+	}
+	for (size_t i = 0; i < 8; ++i)
+	{
+		encodeTangentFrame(Vector3(lanes[0][0][i], lanes[0][1][i], lanes[0][2][i]),
+							Vector3(lanes[1][0][i], lanes[1][1][i], lanes[1][2][i]),
+							Vector3(lanes[2][0][i], lanes[2][1][i], lanes[2][2][i]),
+							(short*)(dst + offsets[i]));
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+GRP_AVX2_FUNCTION inline void normalizeAvx2(__m256& x, __m256& y, __m256& z)
+{
+	__m256 length = _mm256_sqrt_ps(_mm256_fmadd_ps(x, x, _mm256_fmadd_ps(y, y, _mm256_mul_ps(z, z))));
+	__m256 zero = _mm256_cmp_ps(length, _mm256_setzero_ps(), _CMP_EQ_OQ);
+	length = _mm256_blendv_ps(length, _mm256_set1_ps(1.0f), zero);
+	x = _mm256_div_ps(x, length);
+	y = _mm256_div_ps(y, length);
+	z = _mm256_div_ps(z, length);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//8 vertices at a time, rows are blended in pairs with fma
+template<int CHANNELS, int MAX_INFLUENCES, class Source>
+GRP_AVX2_FUNCTION static void skinAvx2(const Source& source,
+										size_t begin,
+										size_t end,
+										const Matrix* palette,
+										const SkinStreams& streams)
+{
+	__m256 minEdge[3] = { _mm256_set1_ps(FLT_MAX), _mm256_set1_ps(FLT_MAX), _mm256_set1_ps(FLT_MAX) };
+	__m256 maxEdge[3] = { _mm256_set1_ps(-FLT_MAX), _mm256_set1_ps(-FLT_MAX), _mm256_set1_ps(-FLT_MAX) };
+	for (size_t i = begin; i + 8 <= end; i += 8)
+	{
+		size_t srcOffsets[8];
+		size_t dstOffsets[8];
+		__m128 rows[8][4];	//vertex, row
+		for (size_t v = 0; v < 8; ++v)
+		{
+			size_t vertexId = source.getVertexId(i + v);
+			srcOffsets[v] = vertexId * streams.srcStride;
+			dstOffsets[v] = vertexId * streams.dstStride;
+			Influences<MAX_INFLUENCES> influences;
+			gatherInfluences<MAX_INFLUENCES>(source, i + v, palette, influences);
+			__m256 weight = _mm256_set1_ps(influences.weights[0]);
+			const float* m = influences.matrices[0];
+			__m256 rows01 = _mm256_mul_ps(_mm256_loadu_ps(m), weight);
+			__m256 rows23 = _mm256_mul_ps(_mm256_loadu_ps(m + 8), weight);
+			for (int j = 1; j < MAX_INFLUENCES; ++j)
+			{
+				weight = _mm256_set1_ps(influences.weights[j]);
+				m = influences.matrices[j];
+				rows01 = _mm256_fmadd_ps(_mm256_loadu_ps(m), weight, rows01);
+				rows23 = _mm256_fmadd_ps(_mm256_loadu_ps(m + 8), weight, rows23);
+			}
+			rows[v][0] = _mm256_castps256_ps128(rows01);
+			rows[v][1] = _mm256_extractf128_ps(rows01, 1);
+			rows[v][2] = _mm256_castps256_ps128(rows23);
+			rows[v][3] = _mm256_extractf128_ps(rows23, 1);
+		}
+		//e[r][c] is element _rc of all 8 vertices
+		__m256 e[4][4];
+		for (int r = 0; r < 4; ++r)
+		{
+			__m128 low[4] = { rows[0][r], rows[1][r], rows[2][r], rows[3][r] };
+			__m128 high[4] = { rows[4][r], rows[5][r], rows[6][r], rows[7][r] };
+			_MM_TRANSPOSE4_PS(low[0], low[1], low[2], low[3]);
+			_MM_TRANSPOSE4_PS(high[0], high[1], high[2], high[3]);
+			for (int c = 0; c < 4; ++c)
+			{
+				e[r][c] = _mm256_insertf128_ps(_mm256_castps128_ps256(low[c]), high[c], 1);
+			}
+		}
+
+		__m256 x, y, z;
+		loadVector3x8(streams.srcPositions, srcOffsets, x, y, z);
+		__m256 p[3];
+		for (int c = 0; c < 3; ++c)
+		{
+			p[c] = _mm256_fmadd_ps(x, e[0][c], _mm256_fmadd_ps(y, e[1][c], _mm256_fmadd_ps(z, e[2][c], e[3][c])));
+			minEdge[c] = _mm256_min_ps(minEdge[c], p[c]);
+			maxEdge[c] = _mm256_max_ps(maxEdge[c], p[c]);
+		}
+		storeVector3x8<storePosition>(streams, streams.dstPositions, dstOffsets, p[0], p[1], p[2]);
+		if (CHANNELS == SKIN_POSITION)
+		{
+			continue;
+		}
+
+		const unsigned char* sources[3] = { streams.srcNormals, streams.srcTangents, streams.srcTangents + sizeof(Vector3) };
+		unsigned char* targets[3] = { streams.dstNormals, streams.dstTangents, streams.dstTangents + getBinormalOffset(streams) };
+		int directionCount = (CHANNELS == SKIN_POSITION_NORMAL_TANGENT) ? 3 : 1;
+		__m256 r[3][3];	//direction, axis
+		for (int d = 0; d < directionCount; ++d)
+		{
+			loadVector3x8(sources[d], srcOffsets, x, y, z);
+			r[d][0] = _mm256_fmadd_ps(x, e[0][0], _mm256_fmadd_ps(y, e[1][0], _mm256_mul_ps(z, e[2][0])));
+			r[d][1] = _mm256_fmadd_ps(x, e[0][1], _mm256_fmadd_ps(y, e[1][1], _mm256_mul_ps(z, e[2][1])));
+			r[d][2] = _mm256_fmadd_ps(x, e[0][2], _mm256_fmadd_ps(y, e[1][2], _mm256_mul_ps(z, e[2][2])));
+			if (d == 0)
+			{
+				normalizeAvx2(r[d][0], r[d][1], r[d][2]);
+			}
+		}
+		if (CHANNELS == SKIN_POSITION_NORMAL_TANGENT && (streams.dstFormat & TANGENT_QUAT) != 0)
+		{
+			storeTangentFramex8(streams.dstNormals, dstOffsets, r);
+			continue;
+		}
+		for (int d = 0; d < directionCount; ++d)
+		{
+			storeVector3x8<storeDirection>(streams, targets[d], dstOffsets, r[d][0], r[d][1], r[d][2]);
+		}
+	}
+	float minLanes[3][8];
+	float maxLanes[3][8];
+	for (int c = 0; c < 3; ++c)
+	{
+		_mm256_storeu_ps(minLanes[c], minEdge[c]);
+		_mm256_storeu_ps(maxLanes[c], maxEdge[c]);
+	}
+	mergeBounds(streams, minLanes[0], maxLanes[0], 8);
+}
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<int CHANNELS, int MAX_INFLUENCES, class Source>
+static void skinRange(const Source& source,
+						size_t count,
+						const Matrix* palette,
+						const SkinStreams& streams)
+{
+	size_t done = 0;
+#if defined (GRP_AVX2)
+	if (isAvx2Supported())
+	{
+		done = count - count % 8;
+		skinAvx2<CHANNELS, MAX_INFLUENCES>(source, 0, done, palette, streams);
+	}
+#endif
+#if defined (GRP_SSE2)
+	if (done == 0)
+	{
+		done = count - count % 4;
+		skinSse2<CHANNELS, MAX_INFLUENCES>(source, 0, done, palette, streams);
+	}
+#endif
+	skinScalar<CHANNELS, MAX_INFLUENCES>(source, done, count, palette, streams);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<class Source>
+static void skinSource(const Source& source,
+						size_t count,
+						const Matrix* palette,
+						SkinChannels channels,
+						size_t maxInfluences,
+						const SkinStreams& streams)
+{
+	//channels * influence count, in that order
+	switch (channels * MAX_VERTEX_INFLUENCE + std::min<size_t>(maxInfluences, MAX_VERTEX_INFLUENCE) - 1)
+	{
+#define GRP_SKIN_CASE(CHANNELS, INFLUENCES)	\
+	case CHANNELS * MAX_VERTEX_INFLUENCE + INFLUENCES - 1:	\
+		skinRange<CHANNELS, INFLUENCES>(source, count, palette, streams);	\
+		break;
+
+	GRP_SKIN_CASE(SKIN_POSITION, 1)
+	GRP_SKIN_CASE(SKIN_POSITION, 2)
+	GRP_SKIN_CASE(SKIN_POSITION, 3)
+	GRP_SKIN_CASE(SKIN_POSITION, 4)
+	GRP_SKIN_CASE(SKIN_POSITION_NORMAL, 1)
+	GRP_SKIN_CASE(SKIN_POSITION_NORMAL, 2)
+	GRP_SKIN_CASE(SKIN_POSITION_NORMAL, 3)
+	GRP_SKIN_CASE(SKIN_POSITION_NORMAL, 4)
+	GRP_SKIN_CASE(SKIN_POSITION_NORMAL_TANGENT, 1)
+	GRP_SKIN_CASE(SKIN_POSITION_NORMAL_TANGENT, 2)
+	GRP_SKIN_CASE(SKIN_POSITION_NORMAL_TANGENT, 3)
+	GRP_SKIN_CASE(SKIN_POSITION_NORMAL_TANGENT, 4)
+
+#undef GRP_SKIN_CASE
+	default:
+		assert(false);
+		break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+size_t getMaxInfluenceCount(const SkinVertex* vertices, size_t count)
+{
+	size_t maxCount = 1;
+	for (size_t i = 0; i < count && maxCount < MAX_VERTEX_INFLUENCE; ++i)
+	{
+		const SkinVertex& vertex = vertices[i];
+		if (vertex.influences[0].weight > 0.999f)
+		{
+			continue;
+		}
+		size_t influenceCount = 1;
+		while (influenceCount < MAX_VERTEX_INFLUENCE
+			&& vertex.influences[influenceCount].weight >= MIN_VERTEX_WEIGHT)
+		{
+			++influenceCount;
+		}
+		maxCount = std::max(maxCount, influenceCount);
+	}
+	return maxCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void skinVertices(const SkinVertex* vertices,
+					size_t count,
+					const Matrix* palette,
+					SkinChannels channels,
+					size_t maxInfluences,
+					const SkinStreams& streams)
+{
+	PERF_NODE_FUNC();
+
+	SkinVertexSource source;
+	source.vertices = vertices;
+	skinSource(source, count, palette, channels, maxInfluences, streams);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void applySkinCopies(const SkinVertex* vertices,
+						size_t count,
+						SkinChannels channels,
+						const SkinStreams& streams)
+{
+	size_t stride = streams.dstStride;
+	size_t positionSize = MeshFile::getDataSize(streams.dstFormat, POSITION);
+	size_t normalSize = MeshFile::getDataSize(streams.dstFormat, NORMAL);
+	bool copyNormals = isNormalCopied(streams, channels);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const SkinVertex& vertex = vertices[i];
+		if (vertex.copyPosition >= 0)
+		{
+			copyVertexData(streams.dstPositions, positionSize, stride, i, vertex.copyPosition);
+		}
+		if (copyNormals && vertex.copyNormal >= 0)
+		{
+			copyVertexData(streams.dstNormals, normalSize, stride, i, vertex.copyNormal);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static void initPackedSource(const PackedSkin& skin, const SkinGroup& group, PackedSource& source)
+{
+	source.vertexIds = &skin.vertexIds[group.first];
+	source.boneIndices = &skin.boneIndices[group.boneOffset];
+	source.weights = skin.weights.empty() ? NULL : &skin.weights[0] + group.weightOffset;
+	source.pairWeights = skin.pairWeights.empty() ? NULL : &skin.pairWeights[0] + group.pairWeightOffset;
+	source.influenceCount = group.influenceCount;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+static bool isGroupCopied(const SkinGroup& group, SkinChannels channels)
+{
+	return (channels == SKIN_POSITION && group.copyPosition)
+		|| (channels == SKIN_POSITION_NORMAL && group.copyNormal);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void skinVertices(const PackedSkin& skin,
+					size_t vertexCount,
+					const Matrix* palette,
+					SkinChannels channels,
+					size_t maxInfluences,
+					const SkinStreams& streams)
+{
+	PERF_NODE_FUNC();
+
+	for (size_t i = 0; i < skin.groups.size(); ++i)
+	{
+		const SkinGroup& group = skin.groups[i];
+		if (isGroupCopied(group, channels))
+		{
+			continue;	//overwritten by copies anyway
+		}
+		//ids are sorted, vertices beyond lod are at the end of each group
+		const unsigned int* firstId = &skin.vertexIds[group.first];
+		size_t count = std::lower_bound(firstId, firstId + group.count, vertexCount) - firstId;
+		if (count == 0)
+		{
+			continue;
+		}
+		PackedSource source;
+		initPackedSource(skin, group, source);
+		//copied positions are duplicates, bounds don't need them
+		SkinStreams groupStreams = streams;
+		if (group.copyPosition)
+		{
+			groupStreams.bounds = NULL;
+		}
+		skinSource(source, count, palette, channels, std::min(maxInfluences, group.influenceCount), groupStreams);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void applySkinCopies(const PackedSkin& skin,
+						size_t vertexCount,
+						SkinChannels channels,
+						const SkinStreams& streams)
+{
+	size_t stride = streams.dstStride;
+	size_t positionSize = MeshFile::getDataSize(streams.dstFormat, POSITION);
+	for (size_t i = 0; i < skin.positionCopies.size() && skin.positionCopies[i].target < vertexCount; ++i)
+	{
+		const SkinCopy& copy = skin.positionCopies[i];
+		copyVertexData(streams.dstPositions, positionSize, stride, copy.target, copy.source);
+	}
+	if (!isNormalCopied(streams, channels))
+	{
+		return;
+	}
+	size_t normalSize = MeshFile::getDataSize(streams.dstFormat, NORMAL);
+	for (size_t i = 0; i < skin.normalCopies.size() && skin.normalCopies[i].target < vertexCount; ++i)
+	{
+		const SkinCopy& copy = skin.normalCopies[i];
+		copyVertexData(streams.dstNormals, normalSize, stride, copy.target, copy.source);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void skinVertexSubset(const PackedSkin& skin,
+						const unsigned int* positions,
+						size_t count,
+						const Matrix* palette,
+						SkinChannels channels,
+						size_t maxInfluences,
+						const SkinStreams& streams)
+{
+	PERF_NODE_FUNC();
+
+	//groups are consecutive in vertexIds, so sorted positions come group by group
+	size_t begin = 0;
+	for (size_t i = 0; i < skin.groups.size() && begin < count; ++i)
+	{
+		const SkinGroup& group = skin.groups[i];
+		size_t end = begin;
+		while (end < count && positions[end] < group.first + group.count)
+		{
+			++end;
+		}
+		if (end > begin && !isGroupCopied(group, channels))
+		{
+			PackedSubsetSource source;
+			initPackedSource(skin, group, source.group);
+			source.positions = positions + begin;
+			source.first = group.first;
+			skinSource(source, end - begin, palette, channels, std::min(maxInfluences, group.influenceCount), streams);
+		}
+		begin = end;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void applySkinCopySubset(const PackedSkin& skin,
+							size_t vertexCount,
+							unsigned int* marks,
+							unsigned int mark,
+							SkinChannels channels,
+							const SkinStreams& streams)
+{
+	//sources come before targets, so marks spread along chains of copies
+	size_t stride = streams.dstStride;
+	size_t positionSize = MeshFile::getDataSize(streams.dstFormat, POSITION);
+	for (size_t i = 0; i < skin.positionCopies.size() && skin.positionCopies[i].target < vertexCount; ++i)
+	{
+		const SkinCopy& copy = skin.positionCopies[i];
+		if (marks[copy.target] == mark || marks[copy.source] == mark)
+		{
+			marks[copy.target] = mark;
+			copyVertexData(streams.dstPositions, positionSize, stride, copy.target, copy.source);
+		}
+	}
+	if (!isNormalCopied(streams, channels))
+	{
+		return;
+	}
+	size_t normalSize = MeshFile::getDataSize(streams.dstFormat, NORMAL);
+	for (size_t i = 0; i < skin.normalCopies.size() && skin.normalCopies[i].target < vertexCount; ++i)
+	{
+		const SkinCopy& copy = skin.normalCopies[i];
+		if (marks[copy.target] == mark || marks[copy.source] == mark)
+		{
+			marks[copy.target] = mark;
+			copyVertexData(streams.dstNormals, normalSize, stride, copy.target, copy.source);
+		}
+	}
+}
+
+}
@@ -0,0 +1,89 @@
+#ifndef __GRP_SKINNING_H__
+#define __GRP_SKINNING_H__
+
+namespace grp
+{
+
+struct SkinVertex;
+struct PackedSkin;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+enum SkinChannels
+{
+	SKIN_POSITION = 0,
+	SKIN_POSITION_NORMAL,
+	SKIN_POSITION_NORMAL_TANGENT	//binormal follows tangent in stream
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//source and destination streams, binormal follows tangent.
+//destination is packed by encodings of dstFormat, source is always floats
+struct SkinStreams
+{
+	const unsigned char*	srcPositions;
+	const unsigned char*	srcNormals;
+	const unsigned char*	srcTangents;
+	unsigned char*			dstPositions;
+	unsigned char*			dstNormals;
+	unsigned char*			dstTangents;
+	size_t					srcStride;
+	size_t					dstStride;
+	AaBox*					bounds;			//grown by skinned positions if not NULL
+	unsigned long			dstFormat;
+	Vector3					positionOffset;	//POSITION_UNORM16 stores (position - offset) * scale
+	Vector3					positionScale;
+};
+
+//highest number of influences any vertex uses, 1 to MAX_VERTEX_INFLUENCE
+size_t getMaxInfluenceCount(const SkinVertex* vertices, size_t count);
+
+//skins vertices with palette, kernel is picked by channels, influence count and cpu.
+//maxInfluences below a vertex's count keeps its first ones renormalized, 1 uses first influence
+//only. vertices copied from others are skinned too, applySkinCopies() overwrites them afterwards
+void skinVertices(const SkinVertex* vertices,
+					size_t count,
+					const Matrix* palette,
+					SkinChannels channels,
+					size_t maxInfluences,
+					const SkinStreams& streams);
+
+void applySkinCopies(const SkinVertex* vertices,
+						size_t count,
+						SkinChannels channels,
+						const SkinStreams& streams);
+
+//same for packed skin, vertices from vertexCount on are left alone. maxInfluences is 1, 2
+//or MAX_VERTEX_INFLUENCE. groups whose wanted channels are all copied are skipped
+void skinVertices(const PackedSkin& skin,
+					size_t vertexCount,
+					const Matrix* palette,
+					SkinChannels channels,
+					size_t maxInfluences,
+					const SkinStreams& streams);
+
+void applySkinCopies(const PackedSkin& skin,
+						size_t vertexCount,
+						SkinChannels channels,
+						const SkinStreams& streams);
+
+//skins only some vertices of packed skin, positions are ascending indices into
+//PackedSkin::vertexIds, already limited to lod vertex count
+void skinVertexSubset(const PackedSkin& skin,
+						const unsigned int* positions,
+						size_t count,
+						const Matrix* palette,
+						SkinChannels channels,
+						size_t maxInfluences,
+						const SkinStreams& streams);
+
+//copies only where target or source has marks[] == mark, and marks the target
+void applySkinCopySubset(const PackedSkin& skin,
+							size_t vertexCount,
+							unsigned int* marks,
+							unsigned int mark,
+							SkinChannels channels,
+							const SkinStreams& streams);
+
+}
+
+#endif
@@ -28,6 +28,43 @@ void SplineSampler::sample(const VECTOR(TransformKey<T>)& keyFrames,
 	assert(keyFrames.size() > 1);
 
 	int before = getKeyFrameByTime(keyFrames, time);
+	sampleInterval(keyFrames, knots, time, before, out);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+void SplineSampler::sample(const VECTOR(TransformKey<T>)& keyFrames,
+							const VECTOR(T)& knots,
+							float time,
+							int& cursor,
+							T& out)
+{
+	assert(!keyFrames.empty());
+	
+	if (time <= keyFrames.front().time)
+	{
+		out = keyFrames.front().transform;
+		return;
+	}
+	if (time >= keyFrames.back().time)
+	{
+		out = keyFrames.back().transform;
+		return;
+	}
+	assert(keyFrames.size() > 1);
+
+	int before = getKeyFrameByCursor(keyFrames, time, cursor);
+	sampleInterval(keyFrames, knots, time, before, out);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+void SplineSampler::sampleInterval(const VECTOR(TransformKey<T>)& keyFrames,
+									const VECTOR(T)& knots,
+									float time,
+									int before,
+									T& out)
+{
 	int after = before + 1;
 	assert(static_cast<size_t>(after) <= keyFrames.size() - 1);
 
@@ -50,5 +87,7 @@ void SplineSampler::sample(const VECTOR(TransformKey<T>)& keyFrames,
 
 template void SplineSampler::sample<Vector3>(const VECTOR(TransformKey<Vector3>)&, const VECTOR(Vector3)&, float, Vector3&);
 template void SplineSampler::sample<Quaternion>(const VECTOR(TransformKey<Quaternion>)&, const VECTOR(Quaternion)&, float, Quaternion&);
+template void SplineSampler::sample<Vector3>(const VECTOR(TransformKey<Vector3>)&, const VECTOR(Vector3)&, float, int&, Vector3&);
+template void SplineSampler::sample<Quaternion>(const VECTOR(TransformKey<Quaternion>)&, const VECTOR(Quaternion)&, float, int&, Quaternion&);
 
 }
@@ -12,6 +12,13 @@ class SplineSampler : public AnimationSampler
 public:
 	template<typename T>
 	static void sample(const VECTOR(TransformKey<T>)& keyFrames, const VECTOR(T)& knots, float time, T& out);
+
+	template<typename T>
+	static void sample(const VECTOR(TransformKey<T>)& keyFrames, const VECTOR(T)& knots, float time, int& cursor, T& out);
+
+private:
+	template<typename T>
+	static void sampleInterval(const VECTOR(TransformKey<T>)& keyFrames, const VECTOR(T)& knots, float time, int before, T& out);
 };
 
 }
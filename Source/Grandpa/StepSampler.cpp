@@ -25,7 +25,16 @@ void StepSampler::sample(const VECTOR(TransformKey<T>)& keyFrames, float time, f
 	out = keyFrames[before].transform;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename T>
+void StepSampler::sample(const AnimationFile& clip, const PackedChannel& channel, size_t frame, float /*factor*/, T& out)
+{
+	clip.decodeKey(channel, frame, out);
+}
+
 template void StepSampler::sample<Vector3>(const VECTOR(TransformKey<Vector3>)&, float, float, Vector3&);
 template void StepSampler::sample<Quaternion>(const VECTOR(TransformKey<Quaternion>)&, float, float, Quaternion&);
+template void StepSampler::sample<Vector3>(const AnimationFile&, const PackedChannel&, size_t, float, Vector3&);
+template void StepSampler::sample<Quaternion>(const AnimationFile&, const PackedChannel&, size_t, float, Quaternion&);
 
 }
@@ -2,6 +2,7 @@
 #define __GRP_STEP_SAMPLER_H__
 
 #include "AnimationSampler.h"
+#include "AnimationFile.h"
 
 namespace grp
 {
@@ -11,6 +12,9 @@ class StepSampler : public AnimationSampler
 public:
 	template<typename T>
 	static void sample(const VECTOR(TransformKey<T>)& keyFrames, float time, float fps, T& out);
+
+	template<typename T>
+	static void sample(const AnimationFile& clip, const PackedChannel& channel, size_t frame, float factor, T& out);
 };
 
 }
@@ -107,6 +107,8 @@ bool CExporter::doExport(LPCWSTR szFilename)
 	swscanf(profileString, L"%f", &m_options.lodLevelScale);
 	::GetPrivateProfileStringW(L"grandpa exporter", L"lod max error", L"0.1", profileString, sizeof(profileString), L"GrandpaMax.ini");
 	swscanf(profileString, L"%f", &m_options.lodMaxError);
+	::GetPrivateProfileStringW(L"grandpa exporter", L"model space error", L"0", profileString, sizeof(profileString), L"GrandpaMax.ini");
+	swscanf(profileString, L"%f", &m_options.modelSpaceError);
 
 	if (!::DialogBoxParam(g_hInstance,
 						  MAKEINTRESOURCE(IDD_PANEL), 
@@ -235,10 +237,34 @@ bool CExporter::ExportAnimation(const wstring& strFilename)
 		file.close();
 		return false;
 	}
+	size_t fileSize = static_cast<size_t>(file.tellp());
 	file.close();
+
+	const grp::KeyReductionReport* report = m_animation->getKeyReductionReport();
+	if (report != NULL)
+	{
+		writeKeyReductionReport(strFilePath + L".txt", *report, fileSize);
+	}
 	return true;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+void CExporter::writeKeyReductionReport(const wstring& strFilePath, const grp::KeyReductionReport& report, size_t fileSize)
+{
+	FILE* file = _wfopen(strFilePath.c_str(), L"wt");
+	if (file == NULL)
+	{
+		return;
+	}
+	fwprintf(file, L"error budget: %f\n", m_options.modelSpaceError);
+	fwprintf(file, L"max error: %f (%s)\n", report.maxError, report.maxErrorBone.c_str());
+	fwprintf(file, L"keys: %u -> %u\n", static_cast<unsigned int>(report.sourceKeyCount), static_cast<unsigned int>(report.keyCount));
+	fwprintf(file, L"key bytes: %u -> %u\n", static_cast<unsigned int>(report.sourceSize), static_cast<unsigned int>(report.size));
+	fwprintf(file, L"stripped bind pose channels: %u\n", static_cast<unsigned int>(report.strippedChannelCount));
+	fwprintf(file, L"file bytes: %u\n", static_cast<unsigned int>(fileSize));
+	fclose(file);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 CExporter::ENUM_NODE_TYPE CExporter::checkNodeType(INode* pNode)
 {
@@ -424,9 +450,20 @@ bool CExporter::BuildAnimation()
 			return false;
 		}
 	}
-	m_animation->splineFitTracks(m_options.positionTolerance,
-								  m_options.rotationTolerance,
-								  m_options.scaleTolerance);
+	if (m_options.modelSpaceError > 0.0f)
+	{
+		if (m_skeleton == NULL && !BuildSkeleton())
+		{
+			return false;
+		}
+		m_animation->reduceKeys(*m_skeleton, m_options.modelSpaceError);
+	}
+	else
+	{
+		m_animation->splineFitTracks(m_options.positionTolerance,
+									  m_options.rotationTolerance,
+									  m_options.scaleTolerance);
+	}
 	switch (m_options.exportType & EXP_ANIM_SAMPLE_MASK)
 	{
 	case EXP_ANIM_SAMPLE_STEP:
@@ -28,6 +28,7 @@ class SkinnedMeshExporter;
 class RigidMeshExporter;
 struct BoneTrack;
 struct CoreBone;
+struct KeyReductionReport;
 struct LodIndices;
 struct SkinVertex;
 }
@@ -94,6 +95,7 @@ struct ExportOptions
 	float					scaleTolerance;
 	float					lodLevelScale;
 	float					lodMaxError;
+	float					modelSpaceError;	//key reduction error budget, 0 to use tolerances above
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -154,6 +156,7 @@ private:
 	bool ExportSkeleton(const std::wstring& strFilename);
 	bool exportMesh(const std::wstring& strFilename);
 	bool ExportAnimation(const std::wstring& strFilename);
+	void writeKeyReductionReport(const std::wstring& strFilePath, const grp::KeyReductionReport& report, size_t fileSize);
 
     bool ExportModel();
 
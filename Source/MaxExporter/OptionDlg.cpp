@@ -58,6 +58,8 @@ void saveSettings( const ExportOptions& options )
 	::WritePrivateProfileStringW( L"grandpa exporter", L"lod level scale", out, L"GrandpaMax.ini" );
 	swprintf( out, sizeof(out), L"%f", options.lodMaxError );
 	::WritePrivateProfileStringW( L"grandpa exporter", L"lod max error", out, L"GrandpaMax.ini" );
+	swprintf( out, sizeof(out), L"%f", options.modelSpaceError );
+	::WritePrivateProfileStringW( L"grandpa exporter", L"model space error", out, L"GrandpaMax.ini" );
 }
 
 void initOptionDlg( HWND hWnd, ExportOptions* options )
@@ -205,6 +207,7 @@ BOOL CALLBACK OptionDlgProc( HWND hWnd, UINT message, WPARAM wParam, LPARAM lPar
 				options->scaleTolerance = 0.001f;
 				options->lodLevelScale = 0.4f;
 				options->lodMaxError = 0.1f;
+				options->modelSpaceError = 0.0f;
 
 				initOptionDlg( hWnd, options );
 